@@ -7,6 +7,13 @@
 #include <map>
 #include <stdexcept>
 #include <functional>
+#include <vector>
+#include <iterator>
+#include <type_traits>
+#if __cplusplus >= 201703L || (defined(_MSVC_LANG) && _MSVC_LANG >= 201703L)
+#include <string_view>
+#define HJSON_HAS_STRING_VIEW 1
+#endif
 
 #define HJSON_OP_DECL_VAL(_T, _O) \
 friend Value operator _O(_T, const Value&); \
@@ -82,6 +89,59 @@ enum class Type {
 
 class Value;
 
+
+// A memory pool that Unmarshal can allocate Value objects and strings from,
+// see DecoderOptions::arena. Allocation is done by moving a pointer forward
+// in a large memory block, and nothing is released until the Arena is
+// destroyed. An Arena is not thread safe, so it should only be used by one
+// Unmarshal call at a time.
+class Arena {
+public:
+  // blockSize is the size of each memory block that the Arena allocates.
+  // Larger allocations get a block of their own.
+  explicit Arena(size_t blockSize = 64 * 1024);
+  ~Arena();
+
+  Arena(const Arena&) = delete;
+  Arena& operator=(const Arena&) = delete;
+
+  // Returns a pointer to size bytes aligned to alignment, which must be a
+  // power of 2 not greater than alignof(std::max_align_t).
+  void *allocate(size_t size, size_t alignment);
+  // The total number of bytes in the memory blocks allocated by the Arena.
+  size_t capacity() const;
+
+private:
+  struct Block;
+
+  Block *head;
+  char *pos, *end;
+  size_t blockSize, total;
+};
+
+// Keeps one copy of each distinct string given to it, see
+// DecoderOptions::internTable. The copies are never changed or released
+// until the InternTable is destroyed. An InternTable is thread safe, so it
+// can be used by several Unmarshal calls at the same time.
+class InternTable {
+public:
+  InternTable();
+  ~InternTable();
+
+  InternTable(const InternTable&) = delete;
+  InternTable& operator=(const InternTable&) = delete;
+
+  // Returns the copy of the size chars at data, the same pointer for equal
+  // strings.
+  const char *intern(const char *data, size_t size);
+  // The number of distinct strings in the table.
+  size_t size() const;
+
+private:
+  class Impl;
+  std::unique_ptr<Impl> impl;
+};
+
 // DecoderOptions defines options for decoding from Hjson.
 struct DecoderOptions {
   // Keep all comments from the Hjson input, store them in
@@ -89,11 +149,71 @@ struct DecoderOptions {
   bool comments = true;
   // Store all whitespace and comments in the Hjson::Value objects so that
   // linefeeds and custom indentation is kept. The "comments" option is
-  // ignored if this option is true.
+  // ignored if this option is true. Unless borrowInputBuffer is true, the
+  // comments refer to a single copy of the input that is kept alive for as
+  // long as any Value from the returned tree exists.
   bool whitespaceAsComments = false;
   // If true, an Hjson::syntax_error exception is thrown from the unmarshal
   // functions if a map contains duplicate keys.
   bool duplicateKeyException = false;
+  // If true, string values that contain no escape sequences (and are not
+  // multiline strings) are not copied from the input buffer. Instead the
+  // Hjson::Value objects refer directly to the input buffer, which must then
+  // be kept alive and unchanged for as long as any Value from the returned
+  // tree exists. Use Value::clone() to get a tree that does not depend on the
+  // input buffer. Comments refer to the input buffer in the same way. Map
+  // keys are always copied. Calling `operator const char*()` on a borrowed
+  // string makes the value keep a zero-terminated copy of it, which is safe
+  // also when several threads read the same tree.
+  // UnmarshalFromFile() owns its input buffer, and keeps it alive for as long
+  // as any Value refers to it. The stream operators and Hjson::PushDecoder
+  // always copy strings and comments.
+  bool borrowInputBuffer = false;
+  // If not null, the Hjson::Value objects and the string values in the
+  // returned tree are allocated from this arena instead of from the heap.
+  // The arena must then be kept alive for as long as any Value from the
+  // returned tree exists. Use Value::clone() to get a tree that does not
+  // depend on the arena. Only part of the tree comes from the arena: the
+  // storage of vectors and maps, map keys and comments are still allocated
+  // from the heap.
+  Arena *arena = nullptr;
+  // If not null, string values that would otherwise be copied from the input
+  // are stored once in this table, and all equal string values in the
+  // returned tree (and in other trees decoded with the same table) refer to
+  // that copy. This saves memory for documents where the same values are
+  // repeated many times, like arrays of similar objects. The table must be
+  // kept alive for as long as any Value from the returned tree exists. Use
+  // Value::clone() to get a tree that does not depend on the table. Map keys
+  // are not interned, each map element owns its key.
+  InternTable *internTable = nullptr;
+  // The maximum number of threads that Unmarshal() and UnmarshalFromFile() may
+  // use, 0 means the number of hardware threads. If greater than 1, large
+  // inputs are first scanned for where the elements of the root map or vector
+  // and of its largest children start. The elements are then decoded in parts
+  // by separate threads and put together into the same tree, with the same
+  // comments and the same syntax errors as when decoded by a single thread.
+  // Not used together with an arena or a duplicateKeyHandler, nor by the
+  // stream operators, the DecodeHandler functions or Hjson::PushDecoder.
+  // UnmarshalBatch() uses the threads for decoding separate inputs instead.
+  unsigned int threads = 1;
+  // If not empty, only the values with these key paths (and the maps and
+  // vectors on the way to them) are decoded. A key path is a list of key
+  // names separated by '.', where "*" matches any key name or vector index
+  // and a number also matches that index in a vector. For example
+  // "services.*.port" keeps only the "port" elements of the maps in the
+  // "services" map. All other elements are left out of the returned tree.
+  // They are skipped by only scanning for where they end, so errors inside
+  // them (like bad escape sequences) are not found. Not used by the
+  // DecodeHandler functions or UnmarshalLazy(), and turns off decoding in
+  // parallel.
+  std::vector<std::string> keyPaths;
+  // If not null, called for each element that is left out because of
+  // keyPaths, with its key path (vector indexes as numbers) and the
+  // positions in the input of the first char of its value and of the char
+  // after the value. Unmarshal() can later decode the value from that part
+  // of the input.
+  std::function<void(const std::string& keyPath, size_t begin, size_t end)>
+    skippedValueHandler = nullptr;
 
   std::function<void(std::string& key, Hjson::Value&)> duplicateKeyHandler = nullptr;
 };
@@ -135,20 +255,38 @@ class MapProxy;
 
 class Value {
   friend class MapProxy;
+  // Used by the decoder, declared in src/hjson_internal.h.
+  friend class ValueInternal;
 
 private:
   class ValueImpl;
   class Comments;
 
-  std::shared_ptr<ValueImpl> prv;
-  std::shared_ptr<Comments> cm;
-  bool root = false;
   struct Position{
-    size_t item = 0;
-    size_t key = 0;
+    std::uint32_t item = 0;
+    std::uint32_t key = 0;
     void reset() { item = 0; key = 0; }
-  } position;
-  Value(std::shared_ptr<ValueImpl>, std::shared_ptr<Comments>, Position pos);
+  };
+
+  // Bool and Null are stored in the Value itself, because no operation
+  // changes them in place. The other types are stored in a reference counted
+  // ValueImpl that is shared by copies of the Value, so that for example +=
+  // on a copy also changes the original, and a pointer to the characters of
+  // a string stays valid for as long as any copy of the Value exists.
+  struct Storage {
+    union {
+      bool b;
+      ValueImpl *impl;
+    };
+    // The Type of a value stored here, or Type::Undefined if impl is used.
+    unsigned char type;
+  } u;
+  // Shared with MapProxy, otherwise owned by this Value. Can be null.
+  Comments *cm = nullptr;
+  Position position;
+
+  Value(ValueImpl*, Comments*, Position pos);
+  void _own_comments();
 
 public:
   Value();
@@ -274,11 +412,10 @@ public:
   void erase(int);
   // Move value on index `from` to index `to`. If `from` is less than `to` the
   // element will actually end up at index `to - 1`. For an Hjson::Value of
-  // type Map, calling this function changes the insertion order but does not
-  // affect the iteration order, since iterations are always done in
-  // alphabetical key order. Throws Hjson::index_out_of_bounds if the index is
-  // out of bounds and this Value is of type Undefined, Vector or Map. Throws
-  // Hjson::type_mismatch if this Value is of any other type.
+  // type Map, calling this function changes the insertion order, which is
+  // also the iteration order. Throws Hjson::index_out_of_bounds if the index
+  // is out of bounds and this Value is of type Undefined, Vector or Map.
+  // Throws Hjson::type_mismatch if this Value is of any other type.
   void move(int from, int to);
   // Returns the number of child elements contained in this Value if this Value
   // is of type Vector or Map. Returns 0 if this Value is of any other type.
@@ -304,9 +441,103 @@ public:
   Value& at(const std::string& key);
   const Value& at(const char *key) const;
   Value& at(const char *key);
-  // Iterations are always done in alphabetical key order. Returns a default
-  // constructed iterator if this Value is of any other type than Map.
-  typedef std::map<std::string, Value> ValueMap;
+  // Returns a pointer to the Value specified by the key parameter, or nullptr
+  // if this Value does not contain the specified key and is of type Undefined
+  // or Map. Throws Hjson::type_mismatch if this Value is of any other type.
+  // Unlike the bracket operators, no std::string or temporary Value is
+  // created, and no reference count is changed. The pointer is invalidated
+  // in the same way as references to map elements (see "Order of map
+  // elements" in README.md).
+  const Value *find(const char *key, size_t keySize) const;
+  Value *find(const char *key, size_t keySize);
+  const Value *find(const char *key) const;
+  Value *find(const char *key);
+  const Value *find(const std::string& key) const;
+  Value *find(const std::string& key);
+#if HJSON_HAS_STRING_VIEW
+  const Value *find(std::string_view key) const {
+    return find(key.data(), key.size());
+  }
+  Value *find(std::string_view key) {
+    return find(key.data(), key.size());
+  }
+#endif
+  // Iterations are done in insertion order. Returns a default constructed
+  // iterator if this Value is of any other type than Map. Iterators of a Map
+  // are invalidated when elements are added to or removed from the Map, but
+  // references to the elements stay valid until the element is erased.
+  struct ValueMap {
+    typedef std::pair<const std::string, Value> value_type;
+
+    // Random access iterator over the elements of a Map.
+    template<class T>
+    class basic_iterator {
+    public:
+      typedef std::random_access_iterator_tag iterator_category;
+      typedef typename std::remove_const<T>::type value_type;
+      typedef std::ptrdiff_t difference_type;
+      typedef T *pointer;
+      typedef T &reference;
+
+      basic_iterator() : p(nullptr) {}
+      explicit basic_iterator(ValueMap::value_type *const *_p) : p(_p) {}
+      // Allows conversion from iterator to const_iterator.
+      template<class U, class = typename std::enable_if<
+        std::is_convertible<U*, T*>::value>::type>
+      basic_iterator(const basic_iterator<U>& other) : p(other.p) {}
+
+      reference operator*() const { return **p; }
+      pointer operator->() const { return *p; }
+      reference operator[](difference_type n) const { return *p[n]; }
+
+      basic_iterator& operator++() { ++p; return *this; }
+      basic_iterator& operator--() { --p; return *this; }
+      basic_iterator operator++(int) { return basic_iterator(p++); }
+      basic_iterator operator--(int) { return basic_iterator(p--); }
+      basic_iterator& operator+=(difference_type n) { p += n; return *this; }
+      basic_iterator& operator-=(difference_type n) { p -= n; return *this; }
+
+      friend basic_iterator operator+(basic_iterator a, difference_type n) {
+        return a += n;
+      }
+      friend basic_iterator operator+(difference_type n, basic_iterator a) {
+        return a += n;
+      }
+      friend basic_iterator operator-(basic_iterator a, difference_type n) {
+        return a -= n;
+      }
+      friend difference_type operator-(const basic_iterator& a,
+        const basic_iterator& b) { return a.p - b.p; }
+      friend bool operator==(const basic_iterator& a, const basic_iterator& b) {
+        return a.p == b.p;
+      }
+      friend bool operator!=(const basic_iterator& a, const basic_iterator& b) {
+        return a.p != b.p;
+      }
+      friend bool operator<(const basic_iterator& a, const basic_iterator& b) {
+        return a.p < b.p;
+      }
+      friend bool operator>(const basic_iterator& a, const basic_iterator& b) {
+        return a.p > b.p;
+      }
+      friend bool operator<=(const basic_iterator& a, const basic_iterator& b) {
+        return a.p <= b.p;
+      }
+      friend bool operator>=(const basic_iterator& a, const basic_iterator& b) {
+        return a.p >= b.p;
+      }
+
+    private:
+      template<class U>
+      friend class basic_iterator;
+
+      // Points into the vector of element pointers of the Map.
+      ValueMap::value_type *const *p;
+    };
+
+    typedef basic_iterator<value_type> iterator;
+    typedef basic_iterator<const value_type> const_iterator;
+  };
   ValueMap::iterator begin();
   ValueMap::iterator end();
   ValueMap::const_iterator begin() const;
@@ -369,20 +600,18 @@ class MapProxy : public Value {
   friend class Value;
 
 private:
-  std::shared_ptr<ValueImpl> parentPrv;
+  // Holds a reference to the map.
+  ValueImpl *parentPrv;
   std::string key;
-  Value *pTarget;
   // True if an explicit assignment has been made to this MapProxy.
   bool wasAssigned;
 
-  MapProxy(std::shared_ptr<ValueImpl> parent, const std::string& key,
-    Value *pTarget);
+  MapProxy(ValueImpl *parent, const std::string& key, Value *pTarget);
 
   // Make the copy constructor private in order to avoid accidental creation of
   // MapProxy variables like this:
   //   auto myVal = val["one"];
-  MapProxy(const MapProxy&) = default;
-  MapProxy(Value&&);
+  MapProxy(const MapProxy&);
 
 public:
   ~MapProxy() override;
@@ -421,6 +650,197 @@ public:
 };
 
 
+// Receives the contents of Hjson input from
+// `Unmarshal(data, dataSize, handler, options)`, which does not create any
+// Hjson::Value objects. The default implementations accept all events,
+// return false from any of them to stop parsing. Keys, strings and comments
+// are not zero-terminated and are only valid during the call.
+class DecodeHandler {
+public:
+  virtual ~DecodeHandler() {}
+
+  virtual bool on_map_begin() { return true; }
+  virtual bool on_map_end() { return true; }
+  virtual bool on_vector_begin() { return true; }
+  virtual bool on_vector_end() { return true; }
+  // The key of the next value in the current map.
+  virtual bool on_key(const char*, size_t) { return true; }
+  virtual bool on_string(const char*, size_t) { return true; }
+  virtual bool on_int64(std::int64_t) { return true; }
+  virtual bool on_double(double) { return true; }
+  virtual bool on_bool(bool) { return true; }
+  virtual bool on_null() { return true; }
+  // Called for each comment (including the comment markers) in the order
+  // they appear in the input if DecoderOptions::comments is true. Also
+  // called for whitespace if DecoderOptions::whitespaceAsComments is true.
+  virtual bool on_comment(const char*, size_t) { return true; }
+};
+
+
+// Decodes many inputs with the same options. Unlike Unmarshal(), a Decoder
+// copies the options only once, and keeps the memory of its parse stacks and
+// string buffer from one call to the next. A Decoder must only be used by one
+// thread at a time.
+class Decoder {
+public:
+  explicit Decoder(const DecoderOptions& options = DecoderOptions());
+  Decoder(Decoder&&);
+  ~Decoder();
+
+  Decoder& operator=(Decoder&&);
+
+  // Like `Unmarshal(const char*, size_t, DecoderOptions)`.
+  Value decode(const char *data, size_t dataSize);
+  // Like `Unmarshal(const char*, DecoderOptions)`.
+  Value decode(const char *data);
+  // Like `Unmarshal(const std::string&, DecoderOptions)`.
+  Value decode(const std::string& data);
+
+private:
+  class Impl;
+  std::unique_ptr<Impl> impl;
+};
+
+
+// Creates a Value tree from input text that arrives in chunks, for example
+// from a pipe or a socket. The chunks can be split anywhere, also inside
+// UTF-8 sequences. Input that has been parsed is discarded (except for the
+// line it ended on), unless the root value can still turn out to be a single
+// value instead of a map or vector. Strings are always copied from the input,
+// DecoderOptions::borrowInputBuffer is ignored.
+class PushDecoder {
+public:
+  explicit PushDecoder(const DecoderOptions& options = DecoderOptions());
+  ~PushDecoder();
+
+  // Parses as much as possible of the input, including all data fed
+  // earlier. Throws Hjson::syntax_error if the input is invalid no matter
+  // what follows.
+  void feed(const char *data, size_t dataSize);
+  // Parses the rest of the input and returns the same result as
+  // `Unmarshal()` would for all data fed since the previous call to
+  // finish(). Throws Hjson::syntax_error for invalid input. After finish(),
+  // or after an exception from feed() or finish(), the PushDecoder is ready
+  // for new input.
+  Value finish();
+
+private:
+  class Impl;
+  std::unique_ptr<Impl> impl;
+};
+
+
+// Reads a sequence of root maps and vectors, one at a time, from a buffer, a
+// stream or a file. Each document must start with '{' or '['. Documents can
+// follow directly after each other or be separated by whitespace and
+// comments, as in a log file with one document per line. The comments before
+// a document and on the same line after it are stored in the returned Value
+// in the same way as by `Unmarshal()`, and so are the positions and the line
+// numbers in error messages (counted from the start of the whole input).
+// Only the current document needs to be in memory, and the parse stacks are
+// reused for all documents.
+class DocumentReader {
+public:
+  // Reads from data, which must be kept alive and unchanged for as long as
+  // the DocumentReader is used (and, if DecoderOptions::borrowInputBuffer is
+  // true, for as long as any Value from it exists).
+  DocumentReader(const char *data, size_t dataSize,
+    const DecoderOptions& options = DecoderOptions());
+  // Reads from the stream in chunks, as needed. The stream must be kept alive
+  // for as long as the DocumentReader is used. Strings and comments are always
+  // copied, DecoderOptions::borrowInputBuffer is ignored.
+  explicit DocumentReader(std::istream& in,
+    const DecoderOptions& options = DecoderOptions());
+  DocumentReader(DocumentReader&&);
+  ~DocumentReader();
+
+  DocumentReader& operator=(DocumentReader&&);
+
+  // Returns a DocumentReader for the file. On POSIX systems the file is
+  // memory-mapped (and the memory of documents that have been read is given
+  // back to the system), otherwise it is read as a stream. Throws
+  // Hjson::file_error if the file cannot be opened for reading.
+  static DocumentReader open_file(const std::string& path,
+    const DecoderOptions& options = DecoderOptions());
+
+  // Stores the next document in "doc" and returns true, or returns false if
+  // there are no more documents. Throws Hjson::syntax_error if the next
+  // document is invalid. The next call then continues at the next line that
+  // starts with '{' or '[', so that invalid documents can be skipped.
+  bool next(Value& doc);
+  // The position in the input of the first char of the document from the
+  // last call to next(), also if it threw an exception.
+  size_t doc_begin() const;
+  // The position in the input after the last char of the document from the
+  // last call to next(), or where the next call to next() will continue
+  // if it threw an exception.
+  size_t doc_end() const;
+
+private:
+  class Impl;
+  std::unique_ptr<Impl> impl;
+
+  explicit DocumentReader(std::unique_ptr<Impl>);
+};
+
+
+// A node in a document that is decoded on demand, returned by
+// UnmarshalLazy() and UnmarshalLazyFromFile(). The input is first only
+// scanned for the structure of its maps and vectors, which is much faster
+// than decoding it. Key names are decoded when a map is first accessed by key
+// or index, and values are decoded by to_value(), so that the cost depends on
+// how much of the document is used rather than on its size. The input is
+// kept alive by the LazyValue objects, and is shared by all LazyValue
+// objects from the same document, which can be used from several threads.
+//
+// Errors in the structure of the input are found when the document is
+// scanned, other errors (like bad escape sequences and duplicate keys if
+// DecoderOptions::duplicateKeyException is true) are found when the part of
+// the input that contains them is decoded. Error messages and positions are
+// the same as from `Unmarshal()`.
+class LazyValue {
+  friend LazyValue openLazyValue(const char*, size_t, const DecoderOptions&,
+    const std::shared_ptr<const void>&);
+
+private:
+  class Document;
+
+  std::shared_ptr<Document> doc;
+  // The index of the node in doc, or if doc is null the decoded value.
+  size_t node;
+  Value val;
+
+  LazyValue(std::shared_ptr<Document>, size_t node);
+  explicit LazyValue(const Value&);
+
+public:
+  // An Undefined value.
+  LazyValue();
+
+  // The same as for the Value that to_value() returns. A value that is not a
+  // map or a vector is decoded to find its type.
+  Type type() const;
+  bool defined() const;
+  bool empty() const;
+  size_t size() const;
+
+  // The same as the const operators of Value: the element with the key
+  // name, or Undefined if the map does not contain it.
+  LazyValue operator[](const std::string&) const;
+  LazyValue operator[](const char*) const;
+  // The element at the index in a vector or a map. The order of map elements
+  // is the same as in the Value that to_value() returns.
+  LazyValue operator[](int) const;
+  std::string key(int index) const;
+
+  // Decodes the value and all of its children. For the root, the result is
+  // the same as from `Unmarshal()`. For an element, the comments before it
+  // and at its key are not included, since they belong to the map or vector
+  // that contains it.
+  Value to_value() const;
+};
+
+
 // Returns a properly indented text representation of the input value tree.
 // Extra options can be specified in the input parameter "options".
 std::string Marshal(const Value& v, const EncoderOptions& options = EncoderOptions());
@@ -448,11 +868,75 @@ Value Unmarshal(const char *data, const DecoderOptions& options = DecoderOptions
 Value Unmarshal(const std::string& data,
   const DecoderOptions& options = DecoderOptions());
 
+// The result of decoding one of the inputs to UnmarshalBatch().
+struct BatchResult {
+  // The decoded tree, or Undefined if the input could not be decoded.
+  Value value;
+  // The message of the Hjson::syntax_error found in the input, or empty if
+  // the input was decoded.
+  std::string error;
+};
+
+// Decodes "count" separate inputs and returns one result per input, in the
+// same order. Syntax errors are returned in the results instead of being
+// thrown. The inputs are divided between up to options.threads threads (0
+// means the number of hardware threads), each input is decoded by a single
+// thread. Each thread reuses its decoder state for all of its inputs, which
+// saves time when the inputs are small. options.duplicateKeyHandler can be
+// called from several threads at the same time. Only the calling thread is
+// used if options.arena is set.
+std::vector<BatchResult> UnmarshalBatch(const std::string *data, size_t count,
+  const DecoderOptions& options = DecoderOptions());
+
+// Like `UnmarshalBatch(const std::string*, size_t, DecoderOptions)`.
+std::vector<BatchResult> UnmarshalBatch(const std::vector<std::string>& data,
+  const DecoderOptions& options = DecoderOptions());
+
+// Parses input text and reports the contents to the handler instead of
+// creating a Value tree. Returns false if the handler stopped the parsing.
+// Throws Hjson::syntax_error for invalid input, possibly after some of the
+// contents have been reported. The DecoderOptions members duplicateKeyHandler,
+// duplicateKeyException, borrowInputBuffer and arena are not used.
+bool Unmarshal(const char *data, size_t dataSize, DecodeHandler& handler,
+  const DecoderOptions& options = DecoderOptions());
+
+// Like `Unmarshal(const char*, size_t, DecodeHandler&, DecoderOptions)`.
+bool Unmarshal(const std::string& data, DecodeHandler& handler,
+  const DecoderOptions& options = DecoderOptions());
+
 // Reads the entire file (in binary mode) and unmarshals it. Throws
-// Hjson::file_error if the file cannot be opened for reading.
+// Hjson::file_error if the file cannot be opened for reading. On POSIX
+// systems the file is memory-mapped instead of copied into memory, and must
+// not be modified while it is being parsed or, if
+// DecoderOptions::borrowInputBuffer is true, while any Value from the
+// returned tree exists.
 Value UnmarshalFromFile(const std::string& path,
   const DecoderOptions& options = DecoderOptions());
 
+// Scans the input for its structure and returns the root of a document that
+// is decoded on demand, see Hjson::LazyValue. data must be kept alive and
+// unchanged for as long as any LazyValue from the document exists (and, if
+// DecoderOptions::borrowInputBuffer is true, for as long as any decoded Value
+// refers to it). Throws Hjson::syntax_error if the structure of the input is
+// invalid. If the root is not a map or a vector, or if
+// DecoderOptions::duplicateKeyHandler is set, the input is decoded right away
+// instead.
+LazyValue UnmarshalLazy(const char *data, size_t dataSize,
+  const DecoderOptions& options = DecoderOptions());
+
+// Like `UnmarshalLazy(const char*, size_t, DecoderOptions)`, but keeps a copy
+// of the input.
+LazyValue UnmarshalLazy(const std::string& data,
+  const DecoderOptions& options = DecoderOptions());
+
+// Like `UnmarshalLazy(const char*, size_t, DecoderOptions)` for the entire
+// file, which is memory-mapped on POSIX systems (and must then not be
+// modified while any LazyValue from it exists) or read into memory
+// otherwise. Throws Hjson::file_error if the file cannot be opened for
+// reading.
+LazyValue UnmarshalLazyFromFile(const std::string& path,
+  const DecoderOptions& options = DecoderOptions());
+
 // Returns a Value tree that is a combination of the input parameters "base"
 // and "ext".
 //
@@ -1,8 +1,16 @@
 void perf_multithread();
+void perf_batch();
+void perf_rootvalue();
+void perf_comments();
+void perf_lazy();
 
 
 int main() {
   perf_multithread();
+  perf_batch();
+  perf_rootvalue();
+  perf_comments();
+  perf_lazy();
 
   return 0;
 }
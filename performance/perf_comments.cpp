@@ -0,0 +1,51 @@
+#include <hjson.h>
+
+#include <chrono>
+#include <string>
+#include <iostream>
+
+
+// Measures decoding of the same commented input without comments, with
+// comments and with whitespace as comments.
+static double _run_decode(const std::string &inString,
+  const Hjson::DecoderOptions &decOpt, int &loopCount)
+{
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+  for (int a = 0; a < 5; ++a) {
+    auto root = Hjson::Unmarshal(inString, decOpt);
+    loopCount += static_cast<int>(root.size());
+  }
+
+  std::chrono::steady_clock::time_point stop = std::chrono::steady_clock::now();
+
+  return std::chrono::duration<double>(stop - start).count();
+}
+
+
+void perf_comments() {
+  std::string inString = "{\n";
+  for (int a = 0; a < 20000; ++a) {
+    auto num = std::to_string(a);
+    inString += "  # entry " + num + "\n  k" + num + ": {\n    name: item " +
+      num + " // trailing\n    vals: [" + num + ", 0.5, true, null]\n  }\n";
+  }
+  inString += "}\n";
+
+  int loopCount = 0;
+  Hjson::DecoderOptions decOpt;
+
+  decOpt.comments = false;
+  std::cout << "Decode without comments: " << _run_decode(inString, decOpt,
+    loopCount) << " seconds" << std::endl;
+  decOpt.comments = true;
+  std::cout << "Decode with comments: " << _run_decode(inString, decOpt,
+    loopCount) << " seconds" << std::endl;
+  decOpt.whitespaceAsComments = true;
+  std::cout << "Decode with whitespace as comments: " << _run_decode(inString,
+    decOpt, loopCount) << " seconds" << std::endl;
+
+  // Also output the loop count, to prove that the unmarshal calls have not
+  // been optimized away.
+  std::cout << "Total loop count: " << loopCount << std::endl;
+}
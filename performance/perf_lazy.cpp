@@ -0,0 +1,59 @@
+#include <hjson.h>
+
+#include <chrono>
+#include <string>
+#include <iostream>
+
+
+// Measures reading a few values from a large config, decoded in full by
+// Unmarshal() compared to decoded on demand by UnmarshalLazy().
+static std::string _makeConfig(int sections) {
+  std::string ret = "{\n";
+
+  for (int a = 0; a < sections; ++a) {
+    auto n = std::to_string(a);
+    ret += "  # section " + n + "\n  section" + n + ": {\n"
+      "    name: quoteless name " + n + "\n"
+      "    \"quoted key\": \"value \\t " + n + "\"\n"
+      "    count: " + n + "\n"
+      "    ratio: 0." + n + "\n"
+      "    tags: [ \"a\", \"b\", 1, 2.5, true ]\n"
+      "    nested: { x: 1, y: 2, z: [ { k: \"v\" }, { k: \"w\" } ] }\n"
+      "    text:\n      '''\n      multi line " + n + "\n      '''\n  }\n";
+  }
+
+  return ret + "}\n";
+}
+
+
+void perf_lazy() {
+  const int sections = 100000;
+  auto inString = _makeConfig(sections);
+  std::int64_t sum = 0;
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+  auto root = Hjson::Unmarshal(inString);
+  for (int a = 0; a < sections; a += 50) {
+    sum += root["section" + std::to_string(a)]["count"].to_int64();
+  }
+
+  std::chrono::steady_clock::time_point mid = std::chrono::steady_clock::now();
+
+  auto lazyRoot = Hjson::UnmarshalLazy(inString);
+  for (int a = 0; a < sections; a += 50) {
+    sum += lazyRoot["section" + std::to_string(a)]["count"].to_value().to_int64();
+  }
+
+  std::chrono::steady_clock::time_point stop = std::chrono::steady_clock::now();
+
+  std::cout << "Runtime (2% of " << inString.size() / (1024 * 1024) <<
+    " MB, full): " << std::chrono::duration<double>(mid - start).count() <<
+    " seconds" << std::endl;
+  std::cout << "Runtime (2% of " << inString.size() / (1024 * 1024) <<
+    " MB, lazy): " << std::chrono::duration<double>(stop - mid).count() <<
+    " seconds" << std::endl;
+
+  // Also output the sum, to prove that the values have been read.
+  std::cout << "Total sum: " << sum << std::endl;
+}
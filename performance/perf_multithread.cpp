@@ -7,10 +7,7 @@
 #include <iostream>
 
 
-static int _run_test() {
-  int loopCount = 0;
-
-  std::string inString = R"(
+static const char *_inString = R"(
 {
   # the comma forces a whitespace check
   numbers:
@@ -62,16 +59,26 @@ static int _run_test() {
 }
 )";
 
+
+static bool _check(const Hjson::Value& root, int a) {
+  // Fewer marshals, because it is slower.
+  if ((a & 0x11) == 0x11) {
+    auto str = Hjson::Marshal(root);
+    return str.at(0) == '{';
+  }
+
+  return !root.empty();
+}
+
+
+static int _run_test() {
+  int loopCount = 0;
+  std::string inString = _inString;
+
   for (int a = 0; a < 10000; ++a) {
     auto root = Hjson::Unmarshal(inString);
 
-    // Fewer marshals, because it is slower.
-    if ((a & 0x11) == 0x11) {
-      auto str = Hjson::Marshal(root);
-      if (str.at(0) == '{') {
-        ++loopCount;
-      }
-    } else if (!root.empty()) {
+    if (_check(root, a)) {
       ++loopCount;
     }
   }
@@ -102,3 +109,31 @@ void perf_multithread() {
   // calls have not been optimized away.
   std::cout << "Total loop count: " << loopCount << std::endl;
 }
+
+
+// The same work as in perf_multithread(), but with the documents decoded by
+// UnmarshalBatch().
+void perf_batch() {
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  std::vector<std::string> inputs(10000, _inString);
+  Hjson::DecoderOptions decOpt;
+  decOpt.threads = 0;
+  int loopCount = 0;
+
+  for (int a = 0; a < 16; ++a) {
+    auto results = Hjson::UnmarshalBatch(inputs, decOpt);
+
+    for (size_t b = 0; b < results.size(); ++b) {
+      if (_check(results[b].value, static_cast<int>(b))) {
+        ++loopCount;
+      }
+    }
+  }
+
+  std::chrono::steady_clock::time_point stop = std::chrono::steady_clock::now();
+
+  std::cout << "Runtime (batch): " << std::chrono::duration<double>(stop -
+    start).count() << " seconds" << std::endl;
+
+  std::cout << "Total loop count (batch): " << loopCount << std::endl;
+}
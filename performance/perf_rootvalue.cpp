@@ -0,0 +1,63 @@
+#include <hjson.h>
+
+#include <chrono>
+#include <string>
+#include <iostream>
+
+
+// Measures the inputs that are most expensive for deciding the form of the
+// root value: a root that is a single long string, and many small documents
+// that each consist of a single value.
+static double _run_long_string(int &loopCount) {
+  std::string inString = "\"" + std::string(16 * 1024 * 1024, 'x') + "\"";
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+  for (int a = 0; a < 10; ++a) {
+    auto root = Hjson::Unmarshal(inString);
+    loopCount += static_cast<int>(root.to_string().size() > 0);
+  }
+
+  std::chrono::steady_clock::time_point stop = std::chrono::steady_clock::now();
+
+  return std::chrono::duration<double>(stop - start).count();
+}
+
+
+static double _run_small_values(int &loopCount) {
+  const char *inStrings[] = {
+    "true",
+    "null",
+    "42",
+    "-17.01e2",
+    "\"a quoted string\"",
+    "a quoteless string",
+  };
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+  for (int a = 0; a < 200000; ++a) {
+    for (auto inString : inStrings) {
+      auto root = Hjson::Unmarshal(inString);
+      loopCount += static_cast<int>(root.defined());
+    }
+  }
+
+  std::chrono::steady_clock::time_point stop = std::chrono::steady_clock::now();
+
+  return std::chrono::duration<double>(stop - start).count();
+}
+
+
+void perf_rootvalue() {
+  int loopCount = 0;
+
+  std::cout << "Root single long string: " << _run_long_string(loopCount) <<
+    " seconds" << std::endl;
+  std::cout << "Root single small values: " << _run_small_values(loopCount) <<
+    " seconds" << std::endl;
+
+  // Also output the loop count, to prove that the unmarshal calls have not
+  // been optimized away.
+  std::cout << "Total loop count: " << loopCount << std::endl;
+}
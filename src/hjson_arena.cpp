@@ -0,0 +1,179 @@
+#include "hjson.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <new>
+
+
+namespace Hjson {
+
+
+struct Arena::Block {
+  Block *next;
+};
+
+
+// Memory returned from the blocks must be aligned for any type.
+static const size_t _blockHeaderSize = (sizeof(void*) +
+  alignof(std::max_align_t) - 1) & ~(alignof(std::max_align_t) - 1);
+
+
+Arena::Arena(size_t _blockSize)
+  : head(nullptr),
+  pos(nullptr),
+  end(nullptr),
+  blockSize(_blockSize),
+  total(0)
+{
+}
+
+
+Arena::~Arena() {
+  while (head) {
+    Block *next = head->next;
+    std::free(head);
+    head = next;
+  }
+}
+
+
+void *Arena::allocate(size_t size, size_t alignment) {
+  size_t padding = (alignment - reinterpret_cast<std::uintptr_t>(pos)) &
+    (alignment - 1);
+
+  if (!pos || padding + size > static_cast<size_t>(end - pos)) {
+    size_t dataSize = std::max(size, blockSize);
+    Block *block = static_cast<Block*>(std::malloc(_blockHeaderSize +
+      dataSize));
+    if (!block) {
+      throw std::bad_alloc();
+    }
+    total += _blockHeaderSize + dataSize;
+
+    char *data = reinterpret_cast<char*>(block) + _blockHeaderSize;
+
+    if (dataSize > blockSize && head) {
+      // Keep using the current block for small allocations, put the large
+      // block after it in the list.
+      block->next = head->next;
+      head->next = block;
+      return data;
+    }
+
+    block->next = head;
+    head = block;
+    pos = data;
+    end = data + dataSize;
+    padding = 0;
+  }
+
+  void *ret = pos + padding;
+  pos += padding + size;
+
+  return ret;
+}
+
+
+size_t Arena::capacity() const {
+  return total;
+}
+
+
+// An open addressing hash table of the strings, which are stored in an Arena.
+class InternTable::Impl {
+public:
+  struct Slot {
+    const char *data;
+    size_t size;
+    std::uint32_t hash;
+  };
+
+  std::mutex mutex;
+  Arena chars;
+  // The number of slots is always a power of 2. Null data means an empty slot.
+  std::vector<Slot> table;
+  size_t count = 0;
+
+  static std::uint32_t hash(const char *data, size_t size);
+  void grow();
+};
+
+
+std::uint32_t InternTable::Impl::hash(const char *data, size_t size) {
+  // FNV-1a
+  std::uint32_t ret = 2166136261u;
+  for (size_t i = 0; i < size; ++i) {
+    ret = (ret ^ static_cast<unsigned char>(data[i])) * 16777619u;
+  }
+  return ret;
+}
+
+
+void InternTable::Impl::grow() {
+  std::vector<Slot> old(std::max<size_t>(64, table.size() * 2));
+  old.swap(table);
+  size_t mask = table.size() - 1;
+  for (const auto& slot : old) {
+    if (slot.data) {
+      size_t i = slot.hash & mask;
+      while (table[i].data) {
+        i = (i + 1) & mask;
+      }
+      table[i] = slot;
+    }
+  }
+}
+
+
+InternTable::InternTable()
+  : impl(new Impl())
+{
+}
+
+
+InternTable::~InternTable() {
+}
+
+
+const char *InternTable::intern(const char *data, size_t size) {
+  std::uint32_t h = Impl::hash(data, size);
+
+  std::lock_guard<std::mutex> lock(impl->mutex);
+
+  // Keep the load factor below 1/2.
+  if ((impl->count + 1) * 2 > impl->table.size()) {
+    impl->grow();
+  }
+
+  size_t mask = impl->table.size() - 1;
+  size_t i = h & mask;
+  while (impl->table[i].data) {
+    const auto& slot = impl->table[i];
+    if (slot.hash == h && slot.size == size &&
+      !std::memcmp(slot.data, data, size))
+    {
+      return slot.data;
+    }
+    i = (i + 1) & mask;
+  }
+
+  // Zero-terminated, so that data is not null even if size is 0.
+  char *copy = static_cast<char*>(impl->chars.allocate(size + 1, 1));
+  std::memcpy(copy, data, size);
+  copy[size] = 0;
+  impl->table[i] = {copy, size, h};
+  ++impl->count;
+
+  return copy;
+}
+
+
+size_t InternTable::size() const {
+  std::lock_guard<std::mutex> lock(impl->mutex);
+  return impl->count;
+}
+
+
+}
@@ -1,9 +1,23 @@
-#include "hjson.h"
+#include "hjson_internal.h"
 #include <vector>
 #include <algorithm>
+#include <atomic>
 #include <cctype>
+#include <cstdint>
 #include <cstring>
+#include <exception>
 #include <fstream>
+#include <limits>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#if defined(__unix__) || defined(__APPLE__)
+# include <fcntl.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <unistd.h>
+# define HJSON_USE_MMAP 1
+#endif
 
 
 namespace Hjson {
@@ -27,21 +41,112 @@ public:
   bool hasComment;
   // cmStart is the first char of the key, cmEnd is the first char after the key.
   int cmStart, cmEnd;
+  // If not null, this is the comment instead of the chars between cmStart and
+  // cmEnd. Used by PushDecoder when the input containing the comment has been
+  // discarded.
+  std::shared_ptr<std::string> text;
+};
+
+
+// Used instead of CommentInfo when no comments are kept, so that nothing is
+// recorded.
+class NoCommentInfo {
+public:
+  static const bool hasComment = false;
+};
+
+
+// Parser policies. Unmarshal() selects one from the DecoderOptions, so that
+// the parser for comment-free decoding does no bookkeeping for comments.
+class NoComments {
+public:
+  typedef NoCommentInfo Info;
+  static const bool keepComments = false;
+};
+
+
+class KeepComments {
+public:
+  typedef CommentInfo Info;
+  static const bool keepComments = true;
+};
+
+
+// The key paths of DecoderOptions::keyPaths as a tree of key names.
+class PathNode {
+public:
+  // True if a key path ends here, so that all of the value is decoded.
+  bool complete = false;
+  std::map<std::string, std::unique_ptr<PathNode> > children;
+  // The child for "*".
+  std::unique_ptr<PathNode> any;
 };
 
 
+template<class Info>
 class DecodeParent {
 public:
+  DecodeParent() {}
+  explicit DecodeParent(Value&& _val) : val(std::move(_val)) {}
+
   Value val;
-  CommentInfo ciBefore, ciKey, ciElemBefore, ciElemExtra;
+  Info ciBefore, ciKey, ciElemBefore, ciElemExtra;
   size_t key_position = 0;
   std::string key;
+  // When checking for duplicate keys, the key is moved from "key" into an
+  // element that is added to val as a placeholder, see _readObjectElemBegin().
+  Value::ValueMap::value_type *placeholder = nullptr;
   bool isRoot = false;
+  // The nodes of the key paths that continue inside this value, or empty if
+  // all of it is decoded.
+  std::vector<const PathNode*> paths;
+  // The index of the current element, if this is a vector.
+  size_t index = 0;
+  // True if this is an element that is left out because of keyPaths.
+  bool skipped = false;
+
+  // The key of the current element, if this is a map.
+  const std::string& currentKey() const {
+    return placeholder ? placeholder->first : key;
+  }
+};
+
+
+// A container whose elements are split into parts for decoding in parallel,
+// found by _scanSplits(). Part 0 starts at the beginning of the container,
+// part i (i > 0) starts at the element at cuts[i - 1].
+class ScannedContainer {
+public:
+  // begin is the position of the container (as in pos_item), end is the
+  // position right after it.
+  size_t begin, end;
+  bool isMap;
+  bool isRoot;
+  // True for a root map without braces.
+  bool withoutBraces;
+  std::vector<size_t> cuts;
 };
 
 
-class Parser {
+template<class Info>
+class SplitContainer : public ScannedContainer {
 public:
+  // Set by the parser of part 0 when it skips the rest of the container, see
+  // _splitAt().
+  bool reached = false;
+  Value val;
+  Info ciElemBefore, ciElemExtra;
+};
+
+
+template<class Policy>
+class BasicParser {
+public:
+  typedef typename Policy::Info CommentInfo;
+  typedef DecodeParent<CommentInfo> Parent;
+  typedef SplitContainer<CommentInfo> Split;
+  static const bool keepComments = Policy::keepComments;
+
   const unsigned char *data;
   size_t dataSize;
   int indexNext;
@@ -49,28 +154,137 @@ public:
   bool withoutBraces;
   DecoderOptions opt;
   std::vector<ParseState> vState;
-  std::vector<DecodeParent> vParent;
+  std::vector<Parent> vParent;
+  // The chars of the string being read by _readString(), kept here so that
+  // the capacity can be reused.
+  std::vector<char> scratch;
+  // Kept alive by borrowed strings, can be null.
+  std::shared_ptr<const void> bufferOwner;
+  // If not null, comments are stored as references to the chars at the same
+  // offsets in commentData, kept alive by commentOwner (which can be null).
+  const char *commentData;
+  std::shared_ptr<const void> commentOwner;
+  // True if more input can follow after data (see PushDecoder).
+  bool partial;
+  // Set when the parser has looked at chars beyond the end of data.
+  bool overrun;
+  // True if the root is a single value instead of a map or vector.
+  bool singleValue;
+  // True if _rootEnd() must not try to parse the input again as a single value.
+  bool noFallback;
+  // The position of data in the whole input, and the number of line feeds in
+  // the input before that position (not counting the first char of the
+  // input). Only a PushDecoder discards input, otherwise these are 0.
+  size_t posBase, lineBase;
+  // If not null, the parse steps report the contents to the handler instead
+  // of creating Values. noValue is then used for all Values on the parse
+  // stack, so that they need not be allocated.
+  DecodeHandler *handler;
+  const Value *noValue;
+  // Only set when decoding in parallel. When the parser reaches the first cut
+  // of a container in splitNext..splitEnd, it skips to the end of that
+  // container.
+  Split *splitNext, *splitEnd;
+  // Made from opt.keyPaths when first needed.
+  std::shared_ptr<const PathNode> pathTree;
 };
 
 
-bool tryParseNumber(Value *pNumber, const char *text, size_t textSize, bool stopAtNext);
+// Thrown by _commit().
+class InputNeeded {};
+
+
+// Thrown when a DecodeHandler stops the parsing.
+class ParseStopped {};
 
 
+// Thrown when the parsers of a parallel decoding find that the input was not
+// split at the start of elements.
+class SplitMismatch {};
+
+
+bool tryParseNumber(const char *text, size_t textSize, bool stopAtNext,
+  bool *pIsInt, std::int64_t *pInt, double *pDouble);
+size_t scanWhite(const unsigned char *data, size_t pos, size_t dataSize);
+size_t scanLineEnd(const unsigned char *data, size_t pos, size_t dataSize);
+size_t scanBlockCommentEnd(const unsigned char *data, size_t pos,
+  size_t dataSize);
+size_t scanStringEnd(const unsigned char *data, size_t pos, size_t dataSize,
+  unsigned char quote);
+
+
+template<class Parser>
+static inline std::string _commentText(Parser *p, const CommentInfo& ci) {
+  if (ci.text) {
+    return *ci.text;
+  }
+
+  return std::string(p->data + ci.cmStart, p->data + ci.cmEnd);
+}
+
+
+// Stops the parsing if a DecodeHandler event returned false.
+static inline void _emit(bool ok) {
+  if (!ok) {
+    throw ParseStopped();
+  }
+}
+
+
+template<class Parser>
+static inline void _emitComment(Parser *p, const CommentInfo& ci) {
+  if (ci.hasComment) {
+    _emit(p->handler->on_comment(reinterpret_cast<const char*>(p->data) +
+      ci.cmStart, ci.cmEnd - ci.cmStart));
+  }
+}
+
+
+template<class Parser>
+static inline void _emitComment(Parser*, const NoCommentInfo&) {
+}
+
+
+template<class Parser>
+static inline void _setComment(Value&, void (Value::*)(const std::string&),
+  Parser*, const NoCommentInfo&)
+{
+}
+
+
+template<class Parser>
+static inline void _setComment(Value&, void (Value::*)(const std::string&),
+  Parser*, const NoCommentInfo&, const NoCommentInfo&)
+{
+}
+
+
+template<class Parser>
 static inline void _setComment(Value& val, void (Value::*fp)(const std::string&),
   Parser *p, const CommentInfo& ci)
 {
   if (ci.hasComment) {
-    (val.*fp)(std::string(p->data + ci.cmStart, p->data + ci.cmEnd));
+    if (p->commentData && !ci.text) {
+      ValueInternal::setBorrowedComment(val, fp, p->commentData + ci.cmStart,
+        ci.cmEnd - ci.cmStart, p->commentOwner);
+    } else {
+      (val.*fp)(_commentText(p, ci));
+    }
   }
 }
 
 
+template<class Parser>
 static inline void _setComment(Value& val, void (Value::*fp)(const std::string&),
   Parser *p, const CommentInfo& ciA, const CommentInfo& ciB)
 {
   if (ciA.hasComment && ciB.hasComment) {
-    (val.*fp)(std::string(p->data + ciA.cmStart, p->data + ciA.cmEnd) +
-      std::string(p->data + ciB.cmStart, p->data + ciB.cmEnd));
+    if (p->commentData && !ciA.text && !ciB.text && ciA.cmEnd == ciB.cmStart) {
+      ValueInternal::setBorrowedComment(val, fp, p->commentData + ciA.cmStart,
+        ciB.cmEnd - ciA.cmStart, p->commentOwner);
+    } else {
+      (val.*fp)(_commentText(p, ciA) + _commentText(p, ciB));
+    }
   } else if (!ciA.hasComment && !ciB.hasComment) {
     (val.*fp)("");
   } else {
@@ -80,6 +294,7 @@ static inline void _setComment(Value& val, void (Value::*fp)(const std::string&)
 }
 
 
+template<class Parser>
 static bool _next(Parser *p) {
   // get the next character.
   if ((size_t)p->indexNext < p->dataSize) {
@@ -89,11 +304,61 @@ static bool _next(Parser *p) {
 
   ++p->indexNext;
   p->ch = 0;
+  p->overrun = true;
 
   return false;
 }
 
+
+// Move to the char at index "pos", same result as calling _next() until
+// indexNext == pos + 1.
+template<class Parser>
+static void _setIndex(Parser *p, size_t pos) {
+  if (pos < p->dataSize) {
+    p->ch = p->data[pos];
+    p->indexNext = static_cast<int>(pos + 1);
+  } else {
+    p->ch = 0;
+    p->indexNext = static_cast<int>(p->dataSize + 1);
+    p->overrun = true;
+  }
+}
+
+
+// Each parse step reads all the input it needs before calling _commit(), and
+// only changes the parse state after that. If more input is needed to know
+// the result of the step, the step is aborted here and PushDecoder runs it
+// again when more input has arrived.
+template<class Parser>
+static void _commit(Parser *p) {
+  if (p->overrun && p->partial) {
+    throw InputNeeded();
+  }
+}
+
+
+// Skip to the line feed that ends the current line comment.
+template<class Parser>
+static void _skipLineComment(Parser *p) {
+  _setIndex(p, scanLineEnd(p->data, p->indexNext, p->dataSize));
+}
+
+
+// Skip past the end of a block comment, assuming ch == '/' and the next char
+// is '*'.
+template<class Parser>
+static void _skipBlockComment(Parser *p) {
+  size_t pos = scanBlockCommentEnd(p->data, p->indexNext + 1, p->dataSize);
+
+  if (pos < p->dataSize && p->data[pos] == '*') {
+    pos += 2;
+  }
+  _setIndex(p, pos);
+}
+
+
 #ifdef UNUSED__PREV
+template<class Parser>
 static bool _prev(Parser *p) {
   // get the previous character.
   if (p->indexNext > 1) {
@@ -105,6 +370,7 @@ static bool _prev(Parser *p) {
 }
 #endif
 
+template<class Parser>
 static void _resetAt(Parser *p) {
   p->indexNext = 0;
   _next(p);
@@ -116,11 +382,12 @@ static bool _isPunctuatorChar(char c) {
 }
 
 
+template<class Parser>
 static std::string _errAt(Parser *p, const std::string& message) {
   if (p->dataSize && (size_t)p->indexNext <= p->dataSize) {
     size_t decoderIndex = std::max(static_cast<size_t>(1), std::min(p->dataSize,
       static_cast<size_t>(p->indexNext))) - 1;
-    size_t i = decoderIndex, col = 0, line = 1;
+    size_t i = decoderIndex, col = 0, line = 1 + p->lineBase;
 
     for (; i > 0 && p->data[i] != '\n'; i--) {
       col++;
@@ -133,6 +400,10 @@ static std::string _errAt(Parser *p, const std::string& message) {
     }
 
     size_t samEnd = std::min((size_t)20, p->dataSize - (decoderIndex - col));
+    if (samEnd < 20) {
+      // The sample would be different with more input.
+      p->overrun = true;
+    }
 
     return message + " at line " + std::to_string(line) + "," +
       std::to_string(col) + " >>> " + std::string((char*)p->data + decoderIndex - col, samEnd);
@@ -142,11 +413,14 @@ static std::string _errAt(Parser *p, const std::string& message) {
 }
 
 
+template<class Parser>
 static unsigned char _peek(Parser *p, int offs) {
   int pos = p->indexNext + offs;
 
   if (pos >= 0 && (size_t)pos < p->dataSize) {
     return p->data[pos];
+  } else if (pos >= 0) {
+    p->overrun = true;
   }
 
   return 0;
@@ -178,10 +452,12 @@ static unsigned char _escapee(unsigned char c) {
 
 
 // Parse a multiline string value.
+template<class Parser>
 static std::string _readMLString(Parser *p) {
-  // Store the string in a new vector, because the length of it might be
+  // Store the string in a separate vector, because the length of it might be
   // different than the length in the input data.
-  std::vector<char> res;
+  auto& res = p->scratch;
+  res.clear();
   int triple = 0;
 
   // we are at ''' +1 - get indent
@@ -244,6 +520,11 @@ static std::string _readMLString(Parser *p) {
       if (p->ch != '\r') {
         res.push_back(p->ch);
         lastLf = false;
+        // Copy the chars up to the next quote or line break. Backslashes are
+        // not special here, they only stop the scan.
+        size_t end = scanStringEnd(p->data, p->indexNext, p->dataSize, '\'');
+        res.insert(res.end(), p->data + p->indexNext, p->data + end);
+        p->indexNext = static_cast<int>(end);
       }
       _next(p);
     }
@@ -275,22 +556,34 @@ static void _toUtf8(std::vector<char> &res, uint32_t uIn) {
 // Parse a string value.
 // callers make sure that (ch === '"' || ch === "'")
 // When parsing for string values, we must look for " and \ characters.
+template<class Parser>
 static std::string _readString(Parser *p, bool allowML) {
-  // Store the string in a new vector, because the length of it might be
+  char exitCh = p->ch;
+  size_t start = p->indexNext;
+  size_t pos = scanStringEnd(p->data, start, p->dataSize, exitCh);
+
+  // A string without escape sequences is copied from the input in one go.
+  if (pos < p->dataSize && p->data[pos] == exitCh) {
+    _setIndex(p, pos + 1);
+    if (allowML && exitCh == '\'' && p->ch == '\'' && pos == start) {
+      // ''' indicates a multiline string
+      _next(p);
+      return _readMLString(p);
+    }
+    return std::string(reinterpret_cast<const char*>(p->data) + start,
+      pos - start);
+  }
+
+  // Store the string in a separate vector, because the length of it might be
   // different than the length in the input data.
-  std::vector<char> res;
+  auto& res = p->scratch;
+  res.assign(p->data + start, p->data + pos);
+  p->indexNext = static_cast<int>(pos);
 
-  char exitCh = p->ch;
   while (_next(p)) {
     if (p->ch == exitCh) {
       _next(p);
-      if (allowML && exitCh == '\'' && p->ch == '\'' && res.size() == 0) {
-        // ''' indicates a multiline string
-        _next(p);
-        return _readMLString(p);
-      } else {
-        return std::string(res.data(), res.size());
-      }
+      return std::string(res.data(), res.size());
     }
     if (p->ch == '\\') {
       unsigned char ech;
@@ -321,6 +614,10 @@ static std::string _readString(Parser *p, bool allowML) {
       throw syntax_error(_errAt(p, "Bad string containing newline"));
     } else {
       res.push_back(p->ch);
+      // Copy the chars up to the next escape sequence or end quote.
+      size_t end = scanStringEnd(p->data, p->indexNext, p->dataSize, exitCh);
+      res.insert(res.end(), p->data + p->indexNext, p->data + end);
+      p->indexNext = static_cast<int>(end);
     }
   }
 
@@ -328,8 +625,90 @@ static std::string _readString(Parser *p, bool allowML) {
 }
 
 
+// Creates a String value from characters that must be copied, to the intern
+// table or the arena if there is one.
+template<class Parser>
+static Value _copyString(Parser *p, const char *data, size_t size) {
+  if (p->opt.internTable) {
+    return ValueInternal::makeBorrowedString(p->opt.arena,
+      p->opt.internTable->intern(data, size), size, nullptr);
+  }
+
+  if (p->opt.arena) {
+    char *copy = static_cast<char*>(p->opt.arena->allocate(size, 1));
+    std::memcpy(copy, data, size);
+    return ValueInternal::makeBorrowedString(p->opt.arena, copy, size,
+      nullptr);
+  }
+
+  return std::string(data, size);
+}
+
+
+// Creates a String value from characters in the input buffer.
+template<class Parser>
+static Value _inputString(Parser *p, const char *data, size_t size) {
+  if (p->opt.borrowInputBuffer) {
+    return ValueInternal::makeBorrowedString(p->opt.arena, data, size,
+      p->bufferOwner);
+  }
+
+  return _copyString(p, data, size);
+}
+
+
+// If the string that starts at the current char does not contain any escape
+// sequences and is not a multiline string, moves past it and sets *pStr to
+// point to its chars in the input buffer. Otherwise returns false without
+// moving.
+// callers make sure that (ch === '"' || ch === "'")
+template<class Parser>
+static bool _readPlainString(Parser *p, const char **pStr, size_t *pSize) {
+  size_t start = p->indexNext;
+  char exitCh = p->ch;
+  size_t pos = scanStringEnd(p->data, start, p->dataSize, exitCh);
+
+  // ''' indicates a multiline string.
+  if (pos < p->dataSize && p->data[pos] == exitCh && !(exitCh == '\'' &&
+    pos == start && _peek(p, 1) == '\''))
+  {
+    _setIndex(p, pos + 1);
+    *pStr = reinterpret_cast<const char*>(p->data) + start;
+    *pSize = pos - start;
+    return true;
+  }
+
+  return false;
+}
+
+
+// Parse a string value, referring to the input buffer or copying directly to
+// the intern table or the arena if allowed by the options and the string does
+// not contain any escape sequences.
+// callers make sure that (ch === '"' || ch === "'")
+template<class Parser>
+static Value _readStringValue(Parser *p) {
+  if (p->opt.borrowInputBuffer || p->opt.arena || p->opt.internTable) {
+    const char *str;
+    size_t size;
+
+    if (_readPlainString(p, &str, &size)) {
+      return _inputString(p, str, size);
+    }
+
+    if (p->opt.arena || p->opt.internTable) {
+      std::string str = _readString(p, true);
+      return _copyString(p, str.data(), str.size());
+    }
+  }
+
+  return _readString(p, true);
+}
+
+
 // quotes for keys are optional in Hjson
 // unless they include {}[],: or whitespace.
+template<class Parser>
 static std::string _readKeyname(Parser *p) {
   if (p->ch == '"' || p->ch == '\'') {
     return _readString(p, false);
@@ -368,36 +747,26 @@ static std::string _readKeyname(Parser *p) {
 }
 
 
-static CommentInfo _white(Parser *p) {
+static CommentInfo _white(BasicParser<KeepComments> *p) {
   CommentInfo ci;
   ci.cmStart = p->indexNext - 1;
 
   while (p->ch > 0) {
     // Skip whitespace.
-    while (p->ch > 0 && p->ch <= ' ') {
-      _next(p);
+    if (p->ch <= ' ') {
+      _setIndex(p, scanWhite(p->data, p->indexNext, p->dataSize));
     }
     // Hjson allows comments
     if (p->ch == '#' || (p->ch == '/' && _peek(p, 0) == '/')) {
       if (p->opt.comments) {
         ci.hasComment = true;
       }
-      while (p->ch > 0 && p->ch != '\n') {
-        _next(p);
-      }
+      _skipLineComment(p);
     } else if (p->ch == '/' && _peek(p, 0) == '*') {
       if (p->opt.comments) {
         ci.hasComment = true;
       }
-      _next(p);
-      _next(p);
-      while (p->ch > 0 && !(p->ch == '*' && _peek(p, 0) == '/')) {
-        _next(p);
-      }
-      if (p->ch > 0) {
-        _next(p);
-        _next(p);
-      }
+      _skipBlockComment(p);
     } else {
       break;
     }
@@ -413,7 +782,7 @@ static CommentInfo _white(Parser *p) {
 }
 
 
-static CommentInfo _getCommentAfter(Parser *p) {
+static CommentInfo _getCommentAfter(BasicParser<KeepComments> *p) {
   CommentInfo ci;
   ci.hasComment = p->opt.whitespaceAsComments;
   ci.cmStart = p->indexNext - 1;
@@ -428,22 +797,12 @@ static CommentInfo _getCommentAfter(Parser *p) {
       if (p->opt.comments) {
         ci.hasComment = true;
       }
-      while (p->ch > 0 && p->ch != '\n') {
-        _next(p);
-      }
+      _skipLineComment(p);
     } else if (p->ch == '/' && _peek(p, 0) == '*') {
       if (p->opt.comments) {
         ci.hasComment = true;
       }
-      _next(p);
-      _next(p);
-      while (p->ch > 0 && !(p->ch == '*' && _peek(p, 0) == '/')) {
-        _next(p);
-      }
-      if (p->ch > 0) {
-        _next(p);
-        _next(p);
-      }
+      _skipBlockComment(p);
     } else {
       break;
     }
@@ -456,9 +815,90 @@ static CommentInfo _getCommentAfter(Parser *p) {
 }
 
 
+static NoCommentInfo _white(BasicParser<NoComments> *p) {
+  while (p->ch > 0) {
+    // Skip whitespace.
+    if (p->ch <= ' ') {
+      _setIndex(p, scanWhite(p->data, p->indexNext, p->dataSize));
+    }
+    // Hjson allows comments
+    if (p->ch == '#' || (p->ch == '/' && _peek(p, 0) == '/')) {
+      _skipLineComment(p);
+    } else if (p->ch == '/' && _peek(p, 0) == '*') {
+      _skipBlockComment(p);
+    } else {
+      break;
+    }
+  }
+
+  return NoCommentInfo();
+}
+
+
+// Without comments there is nothing to record, and the whitespace and
+// comments after the value are skipped by the next _white() anyway.
+static NoCommentInfo _getCommentAfter(BasicParser<NoComments>*) {
+  return NoCommentInfo();
+}
+
+
+// The kinds of values that _scanTfnns() can find.
+enum class TfnnsKind {
+  String,
+  False,
+  Null,
+  True,
+  Int64,
+  Double,
+};
+
+
+// Returns true if the chars are true, false, null or a number, and then sets
+// *pKind. A number is also stored in *pInt or *pDouble.
+static bool _tfnnsKind(const char *pVal, size_t valLen, TfnnsKind *pKind,
+  std::int64_t *pInt, double *pDouble)
+{
+  switch (*pVal)
+  {
+  case 'f':
+    if (valLen == 5 && !std::strncmp(pVal, "false", 5)) {
+      *pKind = TfnnsKind::False;
+      return true;
+    }
+    break;
+  case 'n':
+    if (valLen == 4 && !std::strncmp(pVal, "null", 4)) {
+      *pKind = TfnnsKind::Null;
+      return true;
+    }
+    break;
+  case 't':
+    if (valLen == 4 && !std::strncmp(pVal, "true", 4)) {
+      *pKind = TfnnsKind::True;
+      return true;
+    }
+    break;
+  default:
+    if (*pVal == '-' || (*pVal >= '0' && *pVal <= '9')) {
+      bool isInt;
+      if (tryParseNumber(pVal, valLen, false, &isInt, pInt, pDouble)) {
+        *pKind = isInt ? TfnnsKind::Int64 : TfnnsKind::Double;
+        return true;
+      }
+    }
+  }
+
+  return false;
+}
+
+
 // Hjson strings can be quoteless
-// returns string, true, false, or null.
-static Value _readTfnns2(Parser *p, size_t &valEnd, size_t& valStart) {
+// finds a string, true, false, null or a number. The value is between
+// valStart and valEnd, and a number is also stored in *pInt or *pDouble.
+template<class Parser>
+static TfnnsKind _scanTfnns(Parser *p, size_t &valEnd, size_t& valStart,
+  std::int64_t *pInt, double *pDouble)
+{
   if (_isPunctuatorChar(p->ch)) {
     throw syntax_error(_errAt(p, std::string("Found a punctuator character '") +
       (char)p->ch + std::string("' when expecting a quoteless string (check your syntax)")));
@@ -480,36 +920,14 @@ static Value _readTfnns2(Parser *p, size_t &valEnd, size_t& valStart) {
       p->ch == '#' ||
       (p->ch == '/' && (_peek(p, 0) == '/' || _peek(p, 0) == '*')))
     {
-      const char *pVal = reinterpret_cast<const char*>(p->data) + valStart;
-      size_t valLen = valEnd - valStart;
-
-      switch (*pVal)
+      TfnnsKind kind;
+      if (_tfnnsKind(reinterpret_cast<const char*>(p->data) + valStart,
+        valEnd - valStart, &kind, pInt, pDouble))
       {
-      case 'f':
-        if (valLen == 5 && !std::strncmp(pVal, "false", 5)) {
-          return false;
-        }
-        break;
-      case 'n':
-        if (valLen == 4 && !std::strncmp(pVal, "null", 4)) {
-          return Value(Type::Null);
-        }
-        break;
-      case 't':
-        if (valLen == 4 && !std::strncmp(pVal, "true", 4)) {
-          return true;
-        }
-        break;
-      default:
-        if (*pVal == '-' || (*pVal >= '0' && *pVal <= '9')) {
-          Value number;
-          if (tryParseNumber(&number, pVal, valLen, false)) {
-            return number;
-          }
-        }
+        return kind;
       }
       if (isEol) {
-        return std::string(pVal, valLen);
+        return TfnnsKind::String;
       }
     }
     if (std::isspace(p->ch)) {
@@ -524,11 +942,36 @@ static Value _readTfnns2(Parser *p, size_t &valEnd, size_t& valStart) {
 }
 
 
+// returns string, true, false, null or a number.
+template<class Parser>
+static Value _readTfnns2(Parser *p, size_t &valEnd, size_t& valStart) {
+  std::int64_t i;
+  double d;
+
+  switch (_scanTfnns(p, valEnd, valStart, &i, &d)) {
+  case TfnnsKind::False:
+    return ValueInternal::makeArenaValue(p->opt.arena, false);
+  case TfnnsKind::Null:
+    return ValueInternal::makeArenaValue(p->opt.arena, Type::Null);
+  case TfnnsKind::True:
+    return ValueInternal::makeArenaValue(p->opt.arena, true);
+  case TfnnsKind::Int64:
+    return ValueInternal::makeArenaValue(p->opt.arena, i);
+  case TfnnsKind::Double:
+    return ValueInternal::makeArenaValue(p->opt.arena, d);
+  default:
+    return _inputString(p, reinterpret_cast<const char*>(p->data) + valStart,
+      valEnd - valStart);
+  }
+}
+
+
+template<class Parser>
 static Value _readTfnns(Parser *p) {
   size_t valEnd = 0;
   size_t valStart = 0;
   auto ret = _readTfnns2(p, valEnd, valStart);
-  ret.set_pos_item(valStart);
+  ret.set_pos_item(p->posBase + valStart);
   // Make sure that we include whitespace after the value in the after-comment.
   p->indexNext = static_cast<int>(valEnd);
   _next(p);
@@ -536,92 +979,480 @@ static Value _readTfnns(Parser *p) {
 }
 
 
-// Parse an array value.
-// assuming ch == '['
-static void _readArrayBegin(Parser* p) {
-  p->vParent.back().val = Value(Type::Vector);
-  p->vParent.back().val.set_pos_item(p->indexNext - 1);
-
-  // Skip '['.
-  _next(p);
-
-  p->vParent.back().ciElemBefore = _white(p);
-  p->vParent.back().ciElemExtra = CommentInfo();
+// Skips whitespace and comments in the same way as _white().
+static size_t _scanPastWhite(const unsigned char *data, size_t pos,
+  size_t dataSize)
+{
+  for (;;) {
+    pos = scanWhite(data, pos, dataSize);
+    if (pos >= dataSize) {
+      return pos;
+    }
 
-  if (p->ch == ']') {
-    _setComment(p->vParent.back().val, &Value::set_comment_inside, p, p->vParent.back().ciElemBefore);
-    _next(p);
-    p->vState.back() = ParseState::ValueEnd;
-  } else {
-    p->vState.back() = ParseState::VectorElemEnd;
-    p->vState.push_back(ParseState::ValueBegin);
+    if (data[pos] == '#' || (data[pos] == '/' && pos + 1 < dataSize &&
+      data[pos + 1] == '/'))
+    {
+      pos = scanLineEnd(data, pos, dataSize);
+    } else if (data[pos] == '/' && pos + 1 < dataSize && data[pos + 1] == '*') {
+      pos = scanBlockCommentEnd(data, pos + 2, dataSize);
+      if (pos < dataSize && data[pos] == '*') {
+        pos += 2;
+      }
+    } else {
+      return pos;
+    }
   }
 }
 
 
-static void _readArrayElemEnd(Parser* p) {
-  Value elem = p->vParent.back().val;
-  p->vParent.pop_back();
+// Returns the position after the quoted string that starts at pos, or
+// dataSize + 1 if the string does not end in the same way as in _readString().
+static size_t _scanPastString(const unsigned char *data, size_t pos,
+  size_t dataSize, bool allowML)
+{
+  unsigned char exitCh = data[pos];
 
-  _setComment(elem, &Value::set_comment_before, p, p->vParent.back().ciElemBefore, p->vParent.back().ciElemExtra);
-  auto ciAfter = _white(p);
-  // in Hjson the comma is optional and trailing commas are allowed
-  if (p->ch == ',') {
-    _next(p);
-    // It is unlikely that someone writes a comment after the value but
-    // before the comma, so we include any such comment in "comment_after".
-    p->vParent.back().ciElemExtra = _white(p);
-  } else {
-    p->vParent.back().ciElemExtra = CommentInfo();
-  }
-  if (p->ch == ']') {
-    auto existingAfter = elem.get_comment_after();
-    _setComment(elem, &Value::set_comment_after, p, ciAfter, p->vParent.back().ciElemExtra);
-    if (!existingAfter.empty()) {
-      elem.set_comment_after(existingAfter + elem.get_comment_after());
+  if (allowML && exitCh == '\'' && pos + 2 < dataSize &&
+    data[pos + 1] == '\'' && data[pos + 2] == '\'')
+  {
+    for (pos += 3; pos + 2 < dataSize && data[pos]; ++pos) {
+      if (data[pos] == '\'' && data[pos + 1] == '\'' && data[pos + 2] == '\'') {
+        return pos + 3;
+      }
     }
-    _next(p);
-    p->vState.back() = ParseState::ValueEnd;
-  } else {
-    if (p->ch == 0) {
-      throw syntax_error(_errAt(p, "End of input while parsing an array (did you forget a closing ']'?)"));
+
+    return dataSize + 1;
+  }
+
+  for (++pos; pos < dataSize; ++pos) {
+    pos = scanStringEnd(data, pos, dataSize, exitCh);
+    if (pos >= dataSize) {
+      break;
+    } else if (data[pos] == exitCh) {
+      return pos + 1;
+    } else if (data[pos] == '\\') {
+      ++pos;
+    } else if (data[pos] == '\n' || data[pos] == '\r') {
+      break;
     }
-    p->vParent.back().ciElemBefore = ciAfter;
-    p->vState.push_back(ParseState::ValueBegin);
   }
-  p->vParent.back().val.push_back(elem);
-}
 
+  return dataSize + 1;
+}
 
-static void _readObjectBegin(Parser *p) {
-  p->vParent.back().val = Value(Type::Map);
-  p->vParent.back().val.set_pos_item(p->indexNext - 1);
 
-  if (p->ch == '{') {
-    _next(p);
-    p->vParent.back().ciElemBefore = _white(p);
+// Returns the position of the ':' after the key name that starts at pos, or
+// dataSize if the key name is not valid in the same way as in _readKeyname()
+// or is not followed by ':'.
+static size_t _scanPastKey(const unsigned char *data, size_t pos,
+  size_t dataSize)
+{
+  if (data[pos] == '"' || data[pos] == '\'') {
+    pos = _scanPastString(data, pos, dataSize, false);
+    if (pos > dataSize) {
+      return dataSize;
+    }
+    // Comments are allowed between a quoted key name and ':'.
+    pos = _scanPastWhite(data, pos, dataSize);
   } else {
-    p->vParent.back().ciElemBefore = p->vParent.back().ciBefore;
-    p->vParent.back().ciBefore = CommentInfo();
+    size_t keyStart = pos;
+    while (pos < dataSize && data[pos] > ' ' && !_isPunctuatorChar(data[pos])) {
+      ++pos;
+    }
+    if (pos == keyStart) {
+      return dataSize;
+    }
+    while (pos < dataSize && data[pos] > 0 && data[pos] <= ' ') {
+      ++pos;
+    }
   }
 
-
-  if (p->ch == '}' && !(p->vParent.empty() && p->withoutBraces)) {
-    _setComment(p->vParent.back().val, &Value::set_comment_inside, p, p->vParent.back().ciElemBefore);
-    _next(p);
-    p->vState.back() = ParseState::ValueEnd;
-  } else {
-    p->vState.back() = ParseState::MapElemBegin;
-  }
+  return (pos < dataSize && data[pos] == ':') ? pos : dataSize;
 }
 
 
-static void _readObjectElemBegin(Parser* p) {
-  Value &object = p->vParent.back().val;
+// Returns the position after the quoteless string, number, true, false or
+// null that starts at pos, found in the same way as in _scanTfnns().
+static size_t _scanPastTfnns(const unsigned char *data, size_t pos,
+  size_t dataSize)
+{
+  size_t valStart = pos;
+  size_t valEnd = pos + 1;
 
-  if (p->ch == 0) {
+  for (++pos;; ++pos) {
+    unsigned char c = (pos < dataSize ? data[pos] : 0);
+
+    if (c == '\r' || c == '\n' || c == 0) {
+      return valEnd;
+    }
+    if (c == ',' || c == '}' || c == ']' || c == '#' || (c == '/' &&
+      pos + 1 < dataSize && (data[pos + 1] == '/' || data[pos + 1] == '*')))
+    {
+      TfnnsKind kind;
+      std::int64_t i;
+      double d;
+      if (_tfnnsKind(reinterpret_cast<const char*>(data) + valStart,
+        valEnd - valStart, &kind, &i, &d))
+      {
+        return valEnd;
+      }
+    }
+    if (!std::isspace(c)) {
+      valEnd = pos + 1;
+    }
+  }
+}
+
+
+// Returns the position after the value that starts at pos, skipping maps
+// and vectors in the same way as _scanNodes(). Returns dataSize + 1 if the
+// value is not complete, if it contains something that the parser would not
+// accept or a zero byte, or if it is nested too deeply to be scanned without
+// allocating memory.
+static size_t _scanPastValue(const unsigned char *data, size_t pos,
+  size_t dataSize)
+{
+  // Bit i tells if the container at depth i (counted from the innermost) is
+  // a map.
+  std::uint64_t maps = 0;
+  int depth = 0;
+
+  for (;;) {
+    // At the start of a value.
+    if (pos >= dataSize || data[pos] == 0) {
+      return dataSize + 1;
+    }
+
+    unsigned char c = data[pos];
+    if (c == '{' || c == '[') {
+      if (depth == 64) {
+        return dataSize + 1;
+      }
+      maps = (maps << 1) | (c == '{');
+      ++depth;
+      ++pos;
+    } else {
+      if (c == '"' || c == '\'') {
+        pos = _scanPastString(data, pos, dataSize, true);
+        if (pos > dataSize) {
+          return pos;
+        }
+      } else if (_isPunctuatorChar(c)) {
+        return dataSize + 1;
+      } else {
+        pos = _scanPastTfnns(data, pos, dataSize);
+      }
+      if (depth == 0) {
+        return pos;
+      }
+
+      // After a value, the comma is optional.
+      pos = _scanPastWhite(data, pos, dataSize);
+      if (pos < dataSize && data[pos] == ',') {
+        ++pos;
+      }
+    }
+
+    // At the start of an element or at the end of the container.
+    for (;;) {
+      pos = _scanPastWhite(data, pos, dataSize);
+      if (pos >= dataSize || data[pos] == 0) {
+        return dataSize + 1;
+      } else if (data[pos] != ((maps & 1) ? '}' : ']')) {
+        break;
+      }
+
+      ++pos;
+      maps >>= 1;
+      if (--depth == 0) {
+        return pos;
+      }
+      pos = _scanPastWhite(data, pos, dataSize);
+      if (pos < dataSize && data[pos] == ',') {
+        ++pos;
+      }
+    }
+
+    if (maps & 1) {
+      pos = _scanPastKey(data, pos, dataSize);
+      if (pos >= dataSize) {
+        return dataSize + 1;
+      }
+      pos = _scanPastWhite(data, pos + 1, dataSize);
+    }
+  }
+}
+
+
+// A string, number, boolean or null for a DecodeHandler. It is read before
+// _commit() and reported after it.
+class ScalarEvent {
+public:
+  TfnnsKind kind;
+  // A String is either in the input buffer or in buf.
+  const char *str;
+  size_t size;
+  std::string buf;
+  std::int64_t i;
+  double d;
+};
+
+
+template<class Parser>
+static void _readScalarEvent(Parser *p, ScalarEvent *ev) {
+  if (p->ch == '"' || p->ch == '\'') {
+    ev->kind = TfnnsKind::String;
+    if (!_readPlainString(p, &ev->str, &ev->size)) {
+      ev->buf = _readString(p, true);
+      ev->str = ev->buf.data();
+      ev->size = ev->buf.size();
+    }
+  } else {
+    size_t valEnd = 0;
+    size_t valStart = 0;
+    ev->kind = _scanTfnns(p, valEnd, valStart, &ev->i, &ev->d);
+    ev->str = reinterpret_cast<const char*>(p->data) + valStart;
+    ev->size = valEnd - valStart;
+    // Make sure that we include whitespace after the value in the after-comment.
+    p->indexNext = static_cast<int>(valEnd);
+    _next(p);
+  }
+}
+
+
+template<class Parser>
+static void _emitScalar(Parser *p, const ScalarEvent& ev) {
+  switch (ev.kind) {
+  case TfnnsKind::String:
+    _emit(p->handler->on_string(ev.str, ev.size));
+    break;
+  case TfnnsKind::False:
+    _emit(p->handler->on_bool(false));
+    break;
+  case TfnnsKind::Null:
+    _emit(p->handler->on_null());
+    break;
+  case TfnnsKind::True:
+    _emit(p->handler->on_bool(true));
+    break;
+  case TfnnsKind::Int64:
+    _emit(p->handler->on_int64(ev.i));
+    break;
+  case TfnnsKind::Double:
+    _emit(p->handler->on_double(ev.d));
+    break;
+  }
+}
+
+
+// Called at the start of an element of a map or vector when decoding in
+// parallel. If the element is the first one of part 1 of a split container,
+// skips to the end of the container and returns true. The rest of the
+// elements are decoded by the parsers of the other parts, see
+// _decodeParallel().
+template<class Parser>
+static bool _splitAt(Parser *p, bool inMap) {
+  size_t pos = p->indexNext - 1;
+
+  while (p->splitNext != p->splitEnd && p->splitNext->cuts.front() < pos) {
+    ++p->splitNext;
+  }
+  if (p->splitNext == p->splitEnd || p->splitNext->cuts.front() != pos) {
+    return false;
+  }
+  if (!inMap && (p->vState.size() < 2 ||
+    p->vState[p->vState.size() - 2] != ParseState::VectorElemEnd))
+  {
+    // A map value, not an element.
+    return false;
+  }
+
+  auto& split = *p->splitNext++;
+  auto& parent = p->vParent.back();
+  if (split.isMap != inMap || split.reached ||
+    parent.val.get_pos_item() != static_cast<int>(split.begin))
+  {
+    throw SplitMismatch();
+  }
+
+  split.reached = true;
+  split.val = parent.val;
+  split.ciElemBefore = parent.ciElemBefore;
+  split.ciElemExtra = parent.ciElemExtra;
+
+  if (!inMap) {
+    p->vState.pop_back();
+  }
+  p->vState.back() = ParseState::ValueEnd;
+  _setIndex(p, split.end);
+
+  return true;
+}
+
+
+// Parse an array value.
+// assuming ch == '['
+template<class Parser>
+static void _readArrayBegin(Parser* p) {
+  size_t pos = p->posBase + p->indexNext - 1;
+
+  // Skip '['.
+  _next(p);
+
+  auto ciElemBefore = _white(p);
+  bool isEnd = (p->ch == ']');
+  if (isEnd) {
+    _next(p);
+  }
+  _commit(p);
+
+  if (p->handler) {
+    if (p->vParent.back().isRoot) {
+      _emitComment(p, p->vParent.back().ciBefore);
+    }
+    _emit(p->handler->on_vector_begin());
+    _emitComment(p, ciElemBefore);
+    if (isEnd) {
+      _emit(p->handler->on_vector_end());
+    }
+  } else {
+    p->vParent.back().val = ValueInternal::makeArenaValue(p->opt.arena,
+      Type::Vector);
+    p->vParent.back().val.set_pos_item(pos);
+    if (isEnd) {
+      _setComment(p->vParent.back().val, &Value::set_comment_inside, p,
+        ciElemBefore);
+    }
+  }
+  p->vParent.back().ciElemBefore = ciElemBefore;
+  p->vParent.back().ciElemExtra = typename Parser::CommentInfo();
+
+  if (isEnd) {
+    p->vState.back() = ParseState::ValueEnd;
+  } else {
+    p->vState.back() = ParseState::VectorElemEnd;
+    p->vState.push_back(ParseState::ValueBegin);
+  }
+}
+
+
+template<class Parser>
+static void _readArrayElemEnd(Parser* p) {
+  auto ciAfter = _white(p);
+  typename Parser::CommentInfo ciExtra;
+  // in Hjson the comma is optional and trailing commas are allowed
+  if (p->ch == ',') {
+    _next(p);
+    // It is unlikely that someone writes a comment after the value but
+    // before the comma, so we include any such comment in "comment_after".
+    ciExtra = _white(p);
+  }
+  bool isEnd = (p->ch == ']');
+  if (isEnd) {
+    _next(p);
+  } else if (p->ch == 0) {
+    throw syntax_error(_errAt(p, "End of input while parsing an array (did you forget a closing ']'?)"));
+  }
+  _commit(p);
+
+  if (p->handler) {
+    p->vParent.pop_back();
+    _emitComment(p, ciAfter);
+    _emitComment(p, ciExtra);
+    if (isEnd) {
+      _emit(p->handler->on_vector_end());
+    }
+  } else if (p->vParent.back().skipped) {
+    p->vParent.pop_back();
+  } else {
+    Value elem = std::move(p->vParent.back().val);
+    p->vParent.pop_back();
+
+    _setComment(elem, &Value::set_comment_before, p, p->vParent.back().ciElemBefore, p->vParent.back().ciElemExtra);
+    if (Parser::keepComments && isEnd) {
+      auto existingAfter = elem.get_comment_after();
+      _setComment(elem, &Value::set_comment_after, p, ciAfter, ciExtra);
+      if (!existingAfter.empty()) {
+        elem.set_comment_after(existingAfter + elem.get_comment_after());
+      }
+    }
+    p->vParent.back().val.push_back(elem);
+  }
+  p->vParent.back().ciElemExtra = ciExtra;
+  ++p->vParent.back().index;
+
+  if (isEnd) {
+    p->vState.back() = ParseState::ValueEnd;
+  } else {
+    p->vParent.back().ciElemBefore = ciAfter;
+    p->vState.push_back(ParseState::ValueBegin);
+  }
+}
+
+
+template<class Parser>
+static void _readObjectBegin(Parser *p) {
+  size_t pos = p->posBase + p->indexNext - 1;
+  bool hasBrace = (p->ch == '{');
+  typename Parser::CommentInfo ciElemBefore;
+
+  if (hasBrace) {
+    _next(p);
+    ciElemBefore = _white(p);
+  }
+
+  bool isEnd = (p->ch == '}' && !(p->vParent.empty() && p->withoutBraces));
+  if (isEnd) {
+    _next(p);
+  }
+  _commit(p);
+
+  if (p->handler) {
+    if (p->vParent.back().isRoot) {
+      _emitComment(p, p->vParent.back().ciBefore);
+    }
+    _emit(p->handler->on_map_begin());
+    _emitComment(p, ciElemBefore);
+  } else {
+    p->vParent.back().val = ValueInternal::makeArenaValue(p->opt.arena,
+      Type::Map);
+    p->vParent.back().val.set_pos_item(pos);
+  }
+
+  if (hasBrace) {
+    p->vParent.back().ciElemBefore = ciElemBefore;
+  } else {
+    p->vParent.back().ciElemBefore = p->vParent.back().ciBefore;
+    p->vParent.back().ciBefore = typename Parser::CommentInfo();
+  }
+
+  if (isEnd) {
+    if (p->handler) {
+      _emit(p->handler->on_map_end());
+    } else {
+      _setComment(p->vParent.back().val, &Value::set_comment_inside, p, p->vParent.back().ciElemBefore);
+    }
+    p->vState.back() = ParseState::ValueEnd;
+  } else {
+    p->vState.back() = ParseState::MapElemBegin;
+  }
+}
+
+
+template<class Parser>
+static void _readObjectElemBegin(Parser* p) {
+  if (p->splitNext != p->splitEnd && _splitAt(p, true)) {
+    return;
+  }
+
+  Value &object = p->vParent.back().val;
+
+  if (p->ch == 0) {
     if (p->vParent.size() == 1 && p->withoutBraces) {
-      if (object.empty()) {
+      _commit(p);
+      if (p->handler) {
+        _emit(p->handler->on_map_end());
+      } else if (object.empty()) {
         _setComment(object, &Value::set_comment_inside, p, p->vParent.back().ciElemBefore);
       } else {
         _setComment(object[static_cast<int>(object.size() - 1)],
@@ -634,257 +1465,2547 @@ static void _readObjectElemBegin(Parser* p) {
     }
   }
 
-  p->vParent.back().key_position = p->indexNext - 1;
-  p->vParent.back().key = _readKeyname(p);
-  if (p->vParent.back().isRoot && p->opt.duplicateKeyHandler) {
-    p->opt.duplicateKeyHandler(p->vParent.back().key, object);
+  size_t keyPosition = p->posBase + p->indexNext - 1;
+  auto key = _readKeyname(p);
+  size_t keyEnd = p->indexNext - 1;
+  auto ciKey = _white(p);
+  size_t colonPos = p->indexNext - 1;
+  bool hasColon = (p->ch == ':');
+  if (hasColon) {
+    _next(p);
+  }
+  if (!hasColon || (p->opt.duplicateKeyException && !p->handler)) {
+    // The errors below are found after _commit(), so make sure that the
+    // input sample in the error message is complete (see _errAt()).
+    _peek(p, static_cast<int>(colonPos) + 20 - p->indexNext);
+  }
+  _commit(p);
+
+  p->vParent.back().key_position = keyPosition;
+  p->vParent.back().key = std::move(key);
+  p->vParent.back().ciKey = ciKey;
+
+  if (p->handler) {
+    _emit(p->handler->on_key(p->vParent.back().key.data(),
+      p->vParent.back().key.size()));
+    _emitComment(p, ciKey);
+  } else {
+    if (p->vParent.back().isRoot && p->opt.duplicateKeyHandler) {
+      p->opt.duplicateKeyHandler(p->vParent.back().key, object);
+    }
+
+    if (p->opt.duplicateKeyException) {
+      // Adding the element right away finds a duplicate with the same lookup
+      // that is needed for adding the element anyway. The element gets its
+      // value in _readObjectElemEnd().
+      p->vParent.back().placeholder = ValueInternal::insertElement(object,
+        p->vParent.back().key);
+      if (!p->vParent.back().placeholder) {
+        _setIndex(p, keyEnd);
+        throw syntax_error(_errAt(p, "Found duplicate of key '" + p->vParent.back().key + "'"));
+      }
+    }
+  }
+  if (!hasColon) {
+    _setIndex(p, colonPos);
+    throw syntax_error(_errAt(p, std::string(
+      "Expected ':' instead of '") + (char)(p->ch) + "'"));
+  }
+  p->vState.back() = ParseState::MapElemEnd;
+  p->vState.push_back(ParseState::ValueBegin);
+}
+
+
+template<class Parser>
+static void _readObjectElemEnd(Parser *p) {
+  auto ciAfter = _white(p);
+  typename Parser::CommentInfo ciExtra;
+
+  // in Hjson the comma is optional and trailing commas are allowed
+  if (p->ch == ',') {
+    _next(p);
+    // It is unlikely that someone writes a comment after the value but
+    // before the comma, so we include any such comment in "comment_after".
+    ciExtra = _white(p);
+  }
+
+  // The element is still on the stack, so the parent object is at size - 2.
+  bool isEnd = (p->ch == '}' && !(p->vParent.size() == 2 && p->withoutBraces));
+  if (isEnd) {
+    _next(p);
+  }
+  _commit(p);
+
+  if (p->handler) {
+    p->vParent.pop_back();
+    _emitComment(p, ciAfter);
+    _emitComment(p, ciExtra);
+    if (isEnd) {
+      _emit(p->handler->on_map_end());
+    }
+  } else if (p->vParent.back().skipped) {
+    p->vParent.pop_back();
+    if (p->vParent.back().placeholder) {
+      ValueInternal::eraseLastElement(p->vParent.back().val);
+      p->vParent.back().placeholder = nullptr;
+    }
+  } else {
+    Value elem = std::move(p->vParent.back().val);
+    p->vParent.pop_back();
+    _setComment(elem, &Value::set_comment_key, p, p->vParent.back().ciKey);
+    if (Parser::keepComments && !elem.get_comment_before().empty()) {
+      elem.set_comment_key(elem.get_comment_key() +
+        elem.get_comment_before());
+      elem.set_comment_before("");
+    }
+    _setComment(elem, &Value::set_comment_before, p, p->vParent.back().ciElemBefore, p->vParent.back().ciElemExtra);
+    elem.set_pos_key(p->vParent.back().key_position);
+
+    if (Parser::keepComments && isEnd) {
+      auto existingAfter = elem.get_comment_after();
+      _setComment(elem, &Value::set_comment_after, p, ciAfter, ciExtra);
+      if (!existingAfter.empty()) {
+        elem.set_comment_after(existingAfter + elem.get_comment_after());
+      }
+    }
+    if (p->vParent.back().placeholder) {
+      ValueInternal::fillElement(p->vParent.back().placeholder,
+        std::move(elem));
+      p->vParent.back().placeholder = nullptr;
+    } else {
+      ValueInternal::setElement(p->vParent.back().val,
+        std::move(p->vParent.back().key), std::move(elem));
+    }
+  }
+  p->vParent.back().ciElemExtra = ciExtra;
+
+  if (isEnd) {
+    p->vState.back() = ParseState::ValueEnd;
+  } else {
+    p->vParent.back().ciElemBefore = ciAfter;
+    p->vState.back() = ParseState::MapElemBegin;
+  }
+}
+
+
+static std::shared_ptr<const PathNode> _makePathTree(
+  const std::vector<std::string>& keyPaths)
+{
+  auto root = std::make_shared<PathNode>();
+
+  for (const auto& path : keyPaths) {
+    PathNode *node = root.get();
+    size_t start = 0;
+
+    for (;;) {
+      size_t dot = path.find('.', start);
+      auto name = path.substr(start,
+        dot == std::string::npos ? dot : dot - start);
+      auto& child = (name == "*" ? node->any : node->children[name]);
+      if (!child) {
+        child.reset(new PathNode());
+      }
+      node = child.get();
+      if (dot == std::string::npos) {
+        break;
+      }
+      start = dot + 1;
+    }
+
+    node->complete = true;
+  }
+
+  return root;
+}
+
+
+// Applies DecoderOptions::keyPaths to the root, which must be on top of the
+// parse stack.
+template<class Parser>
+static void _filterRoot(Parser *p) {
+  if (!p->opt.keyPaths.empty() && !p->handler) {
+    if (!p->pathTree) {
+      p->pathTree = _makePathTree(p->opt.keyPaths);
+    }
+    p->vParent.back().paths.assign(1, p->pathTree.get());
+  }
+}
+
+
+// Finds the key paths that continue in the current element of the map or
+// vector on top of the parse stack, and stores them in *pPaths (or nothing if
+// all of the element is decoded). Returns true if the element is left out.
+template<class Parser>
+static bool _filterElement(Parser *p, std::vector<const PathNode*> *pPaths) {
+  const auto& parent = p->vParent.back();
+  std::string index;
+  const std::string *key = &parent.currentKey();
+  bool complete = false;
+
+  if (parent.val.type() == Type::Vector) {
+    index = std::to_string(parent.index);
+    key = &index;
+  }
+
+  auto add = [&](const PathNode *node) {
+    if (node->complete) {
+      complete = true;
+    } else {
+      pPaths->push_back(node);
+    }
+  };
+
+  for (auto node : parent.paths) {
+    auto it = node->children.find(*key);
+    if (it != node->children.end()) {
+      add(it->second.get());
+    }
+    if (node->any) {
+      add(node->any.get());
+    }
+  }
+
+  if (complete) {
+    pPaths->clear();
+    return false;
+  }
+
+  return pPaths->empty();
+}
+
+
+// Moves past the value that starts at the current char without decoding it,
+// and pushes an element that the ElemEnd steps leave out. Returns false
+// without moving if the value must be decoded to find the error in it.
+template<class Parser>
+static bool _skipValue(Parser *p,
+  const typename Parser::CommentInfo& ciBefore)
+{
+  size_t begin = p->indexNext - 1;
+  size_t end = _scanPastValue(p->data, begin, p->dataSize);
+
+  if (end > p->dataSize) {
+    if (p->partial) {
+      // The value might be complete when more input has arrived.
+      p->overrun = true;
+      _commit(p);
+    }
+    return false;
+  }
+  if (p->partial) {
+    // A quoteless value can only end before the end of its line if it is
+    // followed by a punctuator, so the next char must be known.
+    _peek(p, static_cast<int>(scanWhite(p->data, end, p->dataSize)) -
+      p->indexNext);
+  }
+  _setIndex(p, end);
+  _commit(p);
+
+  if (p->opt.skippedValueHandler) {
+    std::string path;
+    for (const auto& parent : p->vParent) {
+      if (&parent != &p->vParent.front()) {
+        path += '.';
+      }
+      path += (parent.val.type() == Type::Vector ?
+        std::to_string(parent.index) : parent.currentKey());
+    }
+    p->opt.skippedValueHandler(path, p->posBase + begin, p->posBase + end);
+  }
+
+  p->vParent.push_back(typename Parser::Parent());
+  p->vParent.back().ciBefore = ciBefore;
+  p->vParent.back().skipped = true;
+  p->vState.back() = ParseState::ValueEnd;
+
+  return true;
+}
+
+
+// Parse a Hjson value. It could be an object, an array, a string, a number or a word.
+template<class Parser>
+static void _readValueBegin(Parser *p) {
+  if (p->splitNext != p->splitEnd && _splitAt(p, false)) {
+    return;
+  }
+
+  auto ciBefore = _white(p);
+  size_t pos = p->posBase + p->indexNext - 1;
+  auto state = ParseState::ValueEnd;
+
+  if (p->handler) {
+    ScalarEvent ev;
+    if (p->ch == '{') {
+      state = ParseState::MapBegin;
+    } else if (p->ch == '[') {
+      state = ParseState::VectorBegin;
+    } else {
+      _readScalarEvent(p, &ev);
+    }
+    _commit(p);
+
+    p->vParent.push_back(typename Parser::Parent(Value(*p->noValue)));
+    _emitComment(p, ciBefore);
+    if (state == ParseState::ValueEnd) {
+      _emitScalar(p, ev);
+    }
+    p->vState.back() = state;
+    return;
+  }
+
+  std::vector<const PathNode*> paths;
+  bool skipped = (!p->vParent.empty() && !p->vParent.back().paths.empty() &&
+    _filterElement(p, &paths));
+  if (skipped && _skipValue(p, ciBefore)) {
+    return;
+  }
+
+  Value val;
+
+  switch (p->ch) {
+  case '{':
+    state = ParseState::MapBegin;
+    break;
+  case '[':
+    state = ParseState::VectorBegin;
+    break;
+  case '"':
+  case '\'':
+    val = _readStringValue(p);
+    val.set_pos_item(pos);
+    break;
+  default:
+    val = _readTfnns(p);
+    break;
+  }
+  _commit(p);
+
+  p->vParent.push_back(typename Parser::Parent(
+    ValueInternal::makeArenaValue(p->opt.arena, Type::Undefined)));
+  p->vParent.back().ciBefore = ciBefore;
+  if (!paths.empty()) {
+    p->vParent.back().paths = std::move(paths);
+  }
+  p->vParent.back().skipped = skipped;
+  if (state == ParseState::ValueEnd) {
+    p->vParent.back().val.assign_with_comments(std::move(val));
+  }
+  p->vState.back() = state;
+}
+
+
+template<class Parser>
+static void _readValueEnd(Parser *p) {
+  auto ciAfter = _getCommentAfter(p);
+  _commit(p);
+
+  if (p->handler) {
+    _emitComment(p, ciAfter);
+  } else {
+    _setComment(p->vParent.back().val, &Value::set_comment_before, p, p->vParent.back().ciBefore);
+    _setComment(p->vParent.back().val, &Value::set_comment_after, p, ciAfter);
+  }
+
+  p->vState.pop_back();
+}
+
+
+template<class Parser>
+static Value _hasTrailing(Parser *p, typename Parser::CommentInfo *ci) {
+  *ci = _white(p);
+  return p->ch > 0;
+}
+
+
+template<class Parser>
+static void _parseStep(Parser* p) {
+  switch (p->vState.back()) {
+  case ParseState::ValueBegin:
+    _readValueBegin(p);
+    break;
+  case ParseState::ValueEnd:
+    _readValueEnd(p);
+    break;
+  case ParseState::MapBegin:
+    _readObjectBegin(p);
+    break;
+  case ParseState::MapElemBegin:
+    _readObjectElemBegin(p);
+    break;
+  case ParseState::MapElemEnd:
+    _readObjectElemEnd(p);
+    break;
+  case ParseState::VectorBegin:
+    _readArrayBegin(p);
+    break;
+  case ParseState::VectorElemEnd:
+    _readArrayElemEnd(p);
+    break;
+  }
+}
+
+
+template<class Parser>
+static void _parseLoop(Parser* p) {
+  while (!p->vState.empty()) {
+    _parseStep(p);
+  }
+}
+
+
+// Returns true if the root value that starts at the current char can be an
+// object without braces, i.e. if the first key name is followed by ':'.
+// Only looks ahead to the end of the first key name and the whitespace after
+// it. The parser position is not changed.
+template<class Parser>
+static bool _rootIsObject(Parser *p) {
+  if (p->ch == 0 || p->ch == '}') {
+    // Empty input is an empty object, and so is a lone closing brace.
+    return true;
+  }
+
+  size_t pos = p->indexNext - 1;
+
+  if (p->ch == '"' || p->ch == '\'') {
+    unsigned char exitCh = p->ch;
+
+    for (++pos; pos < p->dataSize && p->data[pos] != exitCh; ++pos) {
+      if (p->data[pos] == '\n' || p->data[pos] == '\r') {
+        return false;
+      } else if (p->data[pos] == '\\') {
+        ++pos;
+      }
+    }
+    if (pos >= p->dataSize) {
+      p->overrun = true;
+      return false;
+    }
+
+    // Comments are allowed between a quoted key name and ':'.
+    int indexNext = p->indexNext;
+    unsigned char ch = p->ch;
+    _setIndex(p, pos + 1);
+    _white(p);
+    bool ret = (p->ch == ':');
+    p->indexNext = indexNext;
+    p->ch = ch;
+
+    return ret;
+  }
+
+  // Same rules as in _readKeyname(): the key name cannot contain punctuators
+  // and can only be followed by whitespace before ':'.
+  size_t keyStart = pos;
+  while (pos < p->dataSize && p->data[pos] > ' ' &&
+    !_isPunctuatorChar(p->data[pos]))
+  {
+    ++pos;
+  }
+  if (pos == keyStart) {
+    return false;
+  }
+  while (pos < p->dataSize && p->data[pos] > 0 && p->data[pos] <= ' ') {
+    ++pos;
+  }
+  if (pos >= p->dataSize) {
+    p->overrun = true;
+    return false;
+  }
+
+  return (p->data[pos] == ':');
+}
+
+
+// Braces for the root object are optional. Decides the form of the root value
+// and prepares the parse state for it.
+template<class Parser>
+static void _rootBegin(Parser *p) {
+  p->vParent.push_back(p->handler ?
+    typename Parser::Parent(Value(*p->noValue)) : typename Parser::Parent());
+  p->vParent.back().isRoot = true;
+  p->vParent.back().ciBefore = _white(p);
+  _filterRoot(p);
+
+  if (p->ch == '[') {
+    p->vState.push_back(ParseState::VectorBegin);
+  } else if (p->ch == '{') {
+    p->vState.push_back(ParseState::MapBegin);
+  } else if (_rootIsObject(p)) {
+    p->withoutBraces = true;
+    p->vState.push_back(ParseState::MapBegin);
+  } else {
+    // A single JSON value (true/false/null/num/""), start over to get the
+    // comments before the value.
+    p->singleValue = true;
+    _resetAt(p);
+    p->vParent.clear();
+    p->vState.push_back(ParseState::ValueBegin);
+  }
+}
+
+
+// Parses the rest of the input after _rootBegin(), returns the root value.
+template<class Parser>
+static Value _rootEnd(Parser *p) {
+  typename Parser::CommentInfo ciExtra;
+
+  try {
+    _parseLoop(p);
+    if (_hasTrailing(p, &ciExtra)) {
+      throw syntax_error(_errAt(p, "Syntax error, found trailing characters"));
+    }
+  } catch (const syntax_error& e1) {
+    if (p->singleValue) {
+      // Report the error found when parsing the input as a root object
+      // without braces, since that is the default form of the root.
+      p->handler = nullptr;
+      _resetAt(p);
+      p->vParent.clear();
+      p->vState.clear();
+      p->withoutBraces = true;
+      p->vParent.push_back(typename Parser::Parent());
+      p->vParent.back().isRoot = true;
+      p->vParent.back().ciBefore = _white(p);
+      p->vState.push_back(ParseState::MapBegin);
+      _parseLoop(p);
+      throw e1;
+    } else if (p->withoutBraces && !p->noFallback) {
+      // test if we are dealing with a single JSON value instead, which is
+      // possible for a quoteless string containing ':'. Only the first value
+      // of the input is read before finding trailing characters or not.
+      _resetAt(p);
+      p->vParent.clear();
+      p->vState.clear();
+      p->vState.push_back(ParseState::ValueBegin);
+      try {
+        _parseLoop(p);
+        if (_hasTrailing(p, &ciExtra)) {
+          throw syntax_error(_errAt(p, "Syntax error, found trailing characters"));
+        }
+      } catch (const syntax_error&) {
+        throw e1;
+      }
+    } else {
+      throw e1;
+    }
+  }
+
+  if (p->handler) {
+    _emitComment(p, ciExtra);
+    return *p->noValue;
+  }
+
+  Value ret = p->vParent.back().val;
+  if (ciExtra.hasComment) {
+    auto existingAfter = ret.get_comment_after();
+    _setComment(ret, &Value::set_comment_after, p, ciExtra);
+    if (!existingAfter.empty()) {
+      ret.set_comment_after(existingAfter + ret.get_comment_after());
+    }
+  }
+
+  return ret;
+}
+
+
+template<class Parser>
+static Value _rootValue(Parser *p) {
+  _rootBegin(p);
+  return _rootEnd(p);
+}
+
+
+// Keeps track of whether the input after the first line of a root object
+// without braces contains only whitespace and comments. Only then can the
+// input turn out to be a single quoteless string instead, see _rootEnd().
+enum class TailState {
+  FirstKey,
+  FirstLine,
+  White,
+  Slash,
+  LineComment,
+  BlockComment,
+  BlockCommentStar,
+  // Could be a single value, no matter what follows.
+  Undecided,
+  // Cannot be a single value.
+  Failed,
+};
+
+
+// Returns the state after the chars from pos to size.
+static TailState _scanTail(TailState tail, const unsigned char *data,
+  size_t pos, size_t size)
+{
+  for (; pos < size; ++pos) {
+    unsigned char c = data[pos];
+
+    switch (tail) {
+    case TailState::FirstKey:
+      if (c == ':') {
+        tail = TailState::FirstLine;
+      } else if (c == '\r' || c == '\n') {
+        tail = TailState::White;
+      } else if (c == 0 || c == '#' || c == '/') {
+        // The single value could be a number followed by a comment.
+        tail = TailState::Undecided;
+      }
+      break;
+    case TailState::FirstLine:
+      if (c == '\r' || c == '\n') {
+        tail = TailState::White;
+      } else if (c == 0) {
+        tail = TailState::Undecided;
+      }
+      break;
+    case TailState::White:
+      if (c == '#') {
+        tail = TailState::LineComment;
+      } else if (c == '/') {
+        tail = TailState::Slash;
+      } else if (c == 0) {
+        tail = TailState::Undecided;
+      } else if (c > ' ') {
+        tail = TailState::Failed;
+      }
+      break;
+    case TailState::Slash:
+      if (c == '/') {
+        tail = TailState::LineComment;
+      } else if (c == '*') {
+        tail = TailState::BlockComment;
+      } else {
+        tail = TailState::Failed;
+      }
+      break;
+    case TailState::LineComment:
+      if (c == '\n') {
+        tail = TailState::White;
+      }
+      break;
+    case TailState::BlockComment:
+      if (c == '*') {
+        tail = TailState::BlockCommentStar;
+      }
+      break;
+    case TailState::BlockCommentStar:
+      if (c == '/') {
+        tail = TailState::White;
+      } else if (c != '*') {
+        tail = TailState::BlockComment;
+      }
+      break;
+    case TailState::Undecided:
+    case TailState::Failed:
+      return tail;
+    }
+  }
+
+  return tail;
+}
+
+
+// Inputs are split into parts of at least this many bytes when decoding in
+// parallel.
+static const size_t _minPartSize = 64 * 1024;
+
+
+// Finds where the elements of the root container and of its largest children
+// start, and splits the containers into parts of about partSize bytes each.
+// Only the structure of the input is scanned: strings, comments and quoteless
+// values are skipped using the same rules as the parser. Returns false if the
+// input contains something that the parser would not accept or a zero byte,
+// but does not find all errors. The parsers of the parts verify the splits,
+// see _decodeParallel().
+static bool _scanSplits(const unsigned char *data, size_t dataSize,
+  size_t rootBegin, bool rootIsMap, bool withoutBraces, size_t partSize,
+  std::vector<ScannedContainer> *pSplits)
+{
+  struct Frame {
+    bool isMap;
+    // Where the current part of the container starts.
+    size_t partStart;
+  };
+
+  ScannedContainer root = { rootBegin, 0, rootIsMap, true, withoutBraces, {} };
+  ScannedContainer child;
+  // The number of bytes in the current part of the root that belong to other
+  // parts of split children.
+  size_t skipped = 0;
+  std::vector<Frame> stack(1, Frame{ rootIsMap, rootBegin });
+  size_t pos = withoutBraces ? rootBegin : rootBegin + 1;
+
+  for (;;) {
+    // At the start of an element or at the end of the container.
+    pos = _scanPastWhite(data, pos, dataSize);
+    Frame& frame = stack.back();
+
+    if (pos >= dataSize) {
+      if (stack.size() == 1 && withoutBraces) {
+        root.end = pos;
+        break;
+      }
+      return false;
+    }
+
+    unsigned char c = data[pos];
+    if (c == 0) {
+      return false;
+    }
+
+    if (c == (frame.isMap ? '}' : ']') &&
+      !(stack.size() == 1 && withoutBraces))
+    {
+      ++pos;
+      if (stack.size() == 1) {
+        root.end = pos;
+        break;
+      } else if (stack.size() == 2 && !child.cuts.empty()) {
+        child.end = pos;
+        skipped += child.end - child.cuts.front();
+        pSplits->push_back(std::move(child));
+      }
+      stack.pop_back();
+    } else {
+      if (stack.size() <= 2 && pos - frame.partStart -
+        (stack.size() == 1 ? skipped : 0) >= partSize)
+      {
+        (stack.size() == 1 ? root : child).cuts.push_back(pos);
+        frame.partStart = pos;
+        if (stack.size() == 1) {
+          skipped = 0;
+        }
+      }
+
+      if (frame.isMap) {
+        pos = _scanPastKey(data, pos, dataSize);
+        if (pos >= dataSize) {
+          return false;
+        }
+        pos = _scanPastWhite(data, pos + 1, dataSize);
+        if (pos >= dataSize || data[pos] == 0) {
+          return false;
+        }
+        c = data[pos];
+      }
+
+      if (c == '{' || c == '[') {
+        if (stack.size() == 1) {
+          child = ScannedContainer{ pos, 0, c == '{', false, false, {} };
+        }
+        stack.push_back(Frame{ c == '{', pos });
+        ++pos;
+        continue;
+      } else if (c == '"' || c == '\'') {
+        pos = _scanPastString(data, pos, dataSize, true);
+        if (pos > dataSize) {
+          return false;
+        }
+      } else if (_isPunctuatorChar(c)) {
+        return false;
+      } else {
+        pos = _scanPastTfnns(data, pos, dataSize);
+      }
+    }
+
+    // After a value, the comma is optional.
+    pos = _scanPastWhite(data, pos, dataSize);
+    if (pos < dataSize && data[pos] == ',') {
+      ++pos;
+    }
+  }
+
+  if (!root.cuts.empty()) {
+    pSplits->push_back(std::move(root));
+  }
+  std::sort(pSplits->begin(), pSplits->end(), [](const ScannedContainer& a,
+    const ScannedContainer& b) { return a.cuts.front() < b.cuts.front(); });
+
+  return true;
+}
+
+
+// Calls fn(0, worker) ... fn(count - 1, worker) on up to "threads" threads, of
+// which the calling thread is one. "worker" is the index (0 for the calling
+// thread) of the thread that makes the call. Each thread takes the next index
+// as soon as it is done with the previous one. Rethrows the first exception
+// thrown by fn.
+static void _runTasks(unsigned int threads, size_t count,
+  const std::function<void(size_t, size_t)>& fn)
+{
+  std::atomic<size_t> next(0);
+  std::exception_ptr error;
+  std::mutex errorMutex;
+
+  auto work = [&](size_t worker) {
+    for (size_t i = next++; i < count; i = next++) {
+      try {
+        fn(i, worker);
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(errorMutex);
+        if (!error) {
+          error = std::current_exception();
+        }
+      }
+    }
+  };
+
+  std::vector<std::thread> workers;
+  for (size_t a = 1; a < threads && a < count; ++a) {
+    try {
+      workers.emplace_back(work, a);
+    } catch (const std::system_error&) {
+      // Continue with the threads that could be started.
+      break;
+    }
+  }
+  work(0);
+  for (auto& worker : workers) {
+    worker.join();
+  }
+
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
+
+// One of the parts 1..n of a split container.
+template<class Info>
+class SplitPart {
+public:
+  SplitContainer<Info> *split;
+  // The part starts at split->cuts[index].
+  size_t index;
+  // A container with the elements of the part.
+  Value val;
+  // The comment before the first element of the next part.
+  Info ciElemBefore, ciElemExtra;
+};
+
+
+// Decodes the elements of a part. The parser state is set up as if the parser
+// had just finished the element before the part.
+template<class Parser>
+static void _parsePart(const Parser& init,
+  std::vector<typename Parser::Split>& splits,
+  SplitPart<typename Parser::CommentInfo>& part,
+  const std::atomic<bool>& failed)
+{
+  auto& split = *part.split;
+  size_t start = split.cuts[part.index];
+  size_t stop = part.index + 1 < split.cuts.size() ?
+    split.cuts[part.index + 1] : SIZE_MAX;
+  Parser p = init;
+
+  p.withoutBraces = split.withoutBraces;
+  p.splitNext = std::upper_bound(splits.data(), splits.data() + splits.size(),
+    start, [](size_t pos, const typename Parser::Split& s) {
+      return pos < s.cuts.front(); });
+  p.splitEnd = splits.data() + splits.size();
+  p.vParent.push_back(typename Parser::Parent(Value(split.isMap ?
+    Type::Map : Type::Vector)));
+  p.vParent.back().isRoot = split.isRoot;
+  if (split.isMap) {
+    p.vState.push_back(ParseState::MapElemBegin);
+  } else {
+    p.vState.push_back(ParseState::VectorElemEnd);
+    p.vState.push_back(ParseState::ValueBegin);
+  }
+  _setIndex(&p, start);
+
+  size_t elemDepth = split.isMap ? 1 : 2;
+  auto elemState = (split.isMap ? ParseState::MapElemBegin :
+    ParseState::ValueBegin);
+
+  for (;;) {
+    if (p.vState.size() == elemDepth && p.vState.back() == elemState) {
+      size_t pos = p.indexNext - 1;
+      if (pos >= stop) {
+        if (pos != stop) {
+          throw SplitMismatch();
+        }
+        break;
+      }
+      if (failed) {
+        // No need to continue, the input is decoded again.
+        return;
+      }
+    } else if (p.vState.size() == 1 &&
+      p.vState.back() == ParseState::ValueEnd)
+    {
+      // The end of the container.
+      if (stop != SIZE_MAX || p.indexNext - 1 != static_cast<int>(split.end)) {
+        throw SplitMismatch();
+      }
+      break;
+    }
+    _parseStep(&p);
+  }
+
+  part.val = std::move(p.vParent.front().val);
+  part.ciElemBefore = p.vParent.front().ciElemBefore;
+  part.ciElemExtra = p.vParent.front().ciElemExtra;
+}
+
+
+// Decodes the input using several threads. The input is scanned for where
+// the elements of the largest containers start (see _scanSplits()), and
+// the containers are split into parts. The parts are decoded in parallel
+// from the same state as a serial parser would have at the start of the
+// part, and then the elements of each part are added to the container.
+// Returns false if the input should be decoded serially instead, because
+// it is too small, a syntax error was found, or the scan turned out to be
+// wrong.
+template<class Parser>
+static bool _decodeParallel(const Parser& init, unsigned int threads,
+  Value *pRet)
+{
+  typedef typename Parser::Split Split;
+  typedef SplitPart<typename Parser::CommentInfo> Part;
+
+  if (init.dataSize < 2 * _minPartSize) {
+    return false;
+  }
+
+  Parser main = init;
+  _resetAt(&main);
+  _rootBegin(&main);
+  if (main.singleValue) {
+    return false;
+  }
+
+  std::vector<ScannedContainer> scanned;
+  if (!_scanSplits(main.data, main.dataSize, main.indexNext - 1,
+    main.ch != '[', main.withoutBraces, std::max(_minPartSize,
+    main.dataSize / (threads * 4)), &scanned) || scanned.empty())
+  {
+    return false;
+  }
+
+  std::vector<Split> splits(scanned.size());
+  std::vector<Part> parts;
+  for (size_t a = 0; a < scanned.size(); ++a) {
+    static_cast<ScannedContainer&>(splits[a]) = std::move(scanned[a]);
+    for (size_t b = 0; b < splits[a].cuts.size(); ++b) {
+      parts.push_back(Part{ &splits[a], b });
+    }
+  }
+
+  main.splitNext = splits.data();
+  main.splitEnd = splits.data() + splits.size();
+  // Any syntax error is reported by the serial decoding instead.
+  main.noFallback = true;
+
+  std::atomic<bool> failed(false);
+  _runTasks(threads, parts.size() + 1, [&](size_t i, size_t) {
+    if (failed) {
+      return;
+    }
+    try {
+      if (i == 0) {
+        *pRet = _rootEnd(&main);
+      } else {
+        _parsePart(init, splits, parts[i - 1], failed);
+      }
+    } catch (...) {
+      // Syntax errors and SplitMismatch, but also anything else since the
+      // serial decoding might find a syntax error before it.
+      failed = true;
+    }
+  });
+
+  if (failed) {
+    return false;
+  }
+
+  // Add the elements of the parts to the containers, in the same way as in
+  // _readArrayElemEnd() and _readObjectElemEnd().
+  Split *split = nullptr;
+  typename Parser::CommentInfo ciElemBefore, ciElemExtra;
+  for (auto& part : parts) {
+    if (part.split != split) {
+      split = part.split;
+      if (!split->reached) {
+        return false;
+      }
+      ciElemBefore = split->ciElemBefore;
+      ciElemExtra = split->ciElemExtra;
+    }
+
+    _setComment(part.val[0], &Value::set_comment_before, &main, ciElemBefore,
+      ciElemExtra);
+
+    // If a key is also found in another part, the serial decoding must report
+    // the error. In a root without braces the comment after the last element
+    // could then belong to another element, see _readObjectElemBegin().
+    if (ValueInternal::appendElements(split->val, std::move(part.val)) &&
+      (main.opt.duplicateKeyException || split->withoutBraces))
+    {
+      return false;
+    }
+
+    ciElemBefore = part.ciElemBefore;
+    ciElemExtra = part.ciElemExtra;
+  }
+
+  return true;
+}
+
+
+// Prepares the parser for decoding data from the start. The options and the
+// capacity of the parse stacks are kept, so that a parser can be reused for
+// many inputs.
+//
+// bufferOwner is kept alive by the returned tree if options.borrowInputBuffer
+// is true.
+template<class Parser>
+static void _setInput(Parser *p, const char *data, size_t dataSize,
+  const std::shared_ptr<const void>& bufferOwner)
+{
+  p->data = (const unsigned char*) data;
+  p->dataSize = dataSize;
+  p->indexNext = 0;
+  p->ch = ' ';
+  p->withoutBraces = false;
+  p->vState.clear();
+  p->vParent.clear();
+  p->overrun = false;
+  p->singleValue = false;
+  p->noFallback = false;
+  p->commentData = nullptr;
+  p->commentOwner = nullptr;
+
+  if (p->opt.borrowInputBuffer) {
+    p->bufferOwner = bufferOwner;
+    p->commentData = data;
+    p->commentOwner = p->bufferOwner;
+  } else if (p->opt.whitespaceAsComments && dataSize) {
+    p->bufferOwner = nullptr;
+    // Most of the input will be stored as comments. One copy of the input is
+    // cheaper than one string per comment.
+    std::shared_ptr<char> copy(new char[dataSize],
+      std::default_delete<char[]>());
+    std::memcpy(copy.get(), data, dataSize);
+    p->commentData = copy.get();
+    p->commentOwner = std::move(copy);
+  } else {
+    p->bufferOwner = nullptr;
+  }
+}
+
+
+// Lets go of the input and of the decoded values, but keeps the capacity of
+// the parse stacks.
+template<class Parser>
+static void _releaseInput(Parser *p) {
+  p->vState.clear();
+  p->vParent.clear();
+  p->bufferOwner = nullptr;
+  p->commentData = nullptr;
+  p->commentOwner = nullptr;
+}
+
+
+// Decodes data from the start, using the options of the parser.
+template<class Parser>
+static Value _decode(Parser *p, const char *data, size_t dataSize,
+  const std::shared_ptr<const void>& bufferOwner)
+{
+  Value ret;
+
+  try {
+    _setInput(p, data, dataSize, bufferOwner);
+
+    unsigned int threads = (p->opt.threads ? p->opt.threads :
+      std::thread::hardware_concurrency());
+    if (threads <= 1 || p->opt.arena || p->opt.duplicateKeyHandler ||
+      !p->opt.keyPaths.empty() || !_decodeParallel(*p, threads, &ret))
+    {
+      _resetAt(p);
+      // A failed parallel decoding can have set ret.
+      ret.assign_with_comments(_rootValue(p));
+    }
+  } catch (...) {
+    _releaseInput(p);
+    throw;
+  }
+  _releaseInput(p);
+
+  return ret;
+}
+
+
+// Unmarshal parses the Hjson-encoded data and returns a tree of Values.
+//
+// Unmarshal uses the inverse of the encodings that Marshal uses.
+//
+// bufferOwner is kept alive by the returned tree if options.borrowInputBuffer
+// is true.
+template<class Policy>
+static Value _unmarshal(const char *data, size_t dataSize,
+  const DecoderOptions& options, const std::shared_ptr<const void>& bufferOwner)
+{
+  BasicParser<Policy> parser = {
+    nullptr,
+    0,
+    0,
+    ' ',
+    false,
+    options
+  };
+
+  if (parser.opt.whitespaceAsComments) {
+    parser.opt.comments = true;
+  }
+
+  return _decode(&parser, data, dataSize, bufferOwner);
+}
+
+
+static Value _unmarshal(const char *data, size_t dataSize,
+  const DecoderOptions& options, std::shared_ptr<const void> bufferOwner)
+{
+  if (options.comments || options.whitespaceAsComments) {
+    return _unmarshal<KeepComments>(data, dataSize, options,
+      std::move(bufferOwner));
+  }
+
+  return _unmarshal<NoComments>(data, dataSize, options,
+    std::move(bufferOwner));
+}
+
+
+// A parser that is reused for many inputs. Only the parser for the comment
+// policy that the options need is created.
+class ReusableParser {
+public:
+  explicit ReusableParser(const DecoderOptions&);
+
+  std::unique_ptr<BasicParser<KeepComments> > cmParser;
+  std::unique_ptr<BasicParser<NoComments> > parser;
+};
+
+
+ReusableParser::ReusableParser(const DecoderOptions& options) {
+  if (options.comments || options.whitespaceAsComments) {
+    cmParser.reset(new BasicParser<KeepComments>{
+      nullptr,
+      0,
+      0,
+      ' ',
+      false,
+      options
+    });
+    cmParser->opt.comments = true;
+  } else {
+    parser.reset(new BasicParser<NoComments>{
+      nullptr,
+      0,
+      0,
+      ' ',
+      false,
+      options
+    });
+  }
+}
+
+
+Value Unmarshal(const char *data, size_t dataSize, const DecoderOptions& options) {
+  return _unmarshal(data, dataSize, options, nullptr);
+}
+
+
+Value Unmarshal(const char *data, const DecoderOptions& options) {
+  if (!data) {
+    return Value();
+  }
+
+  return Unmarshal(data, std::strlen(data), options);
+}
+
+
+Value Unmarshal(const std::string &data, const DecoderOptions& options) {
+  return Unmarshal(data.c_str(), data.size(), options);
+}
+
+
+template<class Policy>
+static void _unmarshalBatch(const std::string *data, size_t count,
+  const DecoderOptions& options, BatchResult *results)
+{
+  unsigned int threads = (options.arena ? 1 : options.threads ?
+    options.threads : std::thread::hardware_concurrency());
+  if (threads < 1) {
+    threads = 1;
+  }
+  // One parser per thread, created by the thread that uses it.
+  std::vector<std::unique_ptr<BasicParser<Policy> > > parsers(threads);
+
+  _runTasks(threads, count, [&](size_t i, size_t worker) {
+    auto& parser = parsers[worker];
+    if (!parser) {
+      parser.reset(new BasicParser<Policy>{
+        nullptr,
+        0,
+        0,
+        ' ',
+        false,
+        options
+      });
+      if (parser->opt.whitespaceAsComments) {
+        parser->opt.comments = true;
+      }
+      // The threads are used for separate inputs instead.
+      parser->opt.threads = 1;
+    }
+
+    try {
+      results[i].value = _decode(parser.get(), data[i].c_str(), data[i].size(),
+        nullptr);
+    } catch (const syntax_error& e) {
+      results[i].error = e.what();
+    }
+  });
+}
+
+
+std::vector<BatchResult> UnmarshalBatch(const std::string *data, size_t count,
+  const DecoderOptions& options)
+{
+  std::vector<BatchResult> results(count);
+
+  if (options.comments || options.whitespaceAsComments) {
+    _unmarshalBatch<KeepComments>(data, count, options, results.data());
+  } else {
+    _unmarshalBatch<NoComments>(data, count, options, results.data());
+  }
+
+  return results;
+}
+
+
+std::vector<BatchResult> UnmarshalBatch(const std::vector<std::string>& data,
+  const DecoderOptions& options)
+{
+  return UnmarshalBatch(data.data(), data.size(), options);
+}
+
+
+class Decoder::Impl : public ReusableParser {
+public:
+  explicit Impl(const DecoderOptions& options) : ReusableParser(options) {}
+};
+
+
+Decoder::Decoder(const DecoderOptions& options)
+  : impl(new Impl(options))
+{
+}
+
+
+Decoder::Decoder(Decoder&&) = default;
+
+
+Decoder::~Decoder() {
+}
+
+
+Decoder& Decoder::operator=(Decoder&&) = default;
+
+
+Value Decoder::decode(const char *data, size_t dataSize) {
+  if (impl->cmParser) {
+    return _decode(impl->cmParser.get(), data, dataSize, nullptr);
+  }
+
+  return _decode(impl->parser.get(), data, dataSize, nullptr);
+}
+
+
+Value Decoder::decode(const char *data) {
+  if (!data) {
+    return Value();
+  }
+
+  return decode(data, std::strlen(data));
+}
+
+
+Value Decoder::decode(const std::string& data) {
+  return decode(data.c_str(), data.size());
+}
+
+
+// Reports a root value that has been parsed into a tree.
+static void _emitRootValue(DecodeHandler& handler, const Value& root) {
+  auto comment = root.get_comment_before();
+  if (!comment.empty()) {
+    _emit(handler.on_comment(comment.data(), comment.size()));
+  }
+
+  switch (root.type()) {
+  case Type::String:
+    {
+      auto str = root.to_string();
+      _emit(handler.on_string(str.data(), str.size()));
+    }
+    break;
+  case Type::Int64:
+    _emit(handler.on_int64(root.to_int64()));
+    break;
+  case Type::Double:
+    _emit(handler.on_double(root.to_double()));
+    break;
+  case Type::Bool:
+    _emit(handler.on_bool(static_cast<bool>(root)));
+    break;
+  default:
+    _emit(handler.on_null());
+    break;
+  }
+
+  comment = root.get_comment_after();
+  if (!comment.empty()) {
+    _emit(handler.on_comment(comment.data(), comment.size()));
+  }
+}
+
+
+template<class Policy>
+static bool _unmarshal(const char *data, size_t dataSize,
+  DecodeHandler& handler, const DecoderOptions& options)
+{
+  Value noValue;
+  BasicParser<Policy> parser = {
+    (const unsigned char*) data,
+    dataSize,
+    0,
+    ' ',
+    false,
+    options
+  };
+
+  if (parser.opt.whitespaceAsComments) {
+    parser.opt.comments = true;
+  }
+
+  parser.handler = &handler;
+  parser.noValue = &noValue;
+  // Events cannot be taken back, the single value case is handled below.
+  parser.noFallback = true;
+
+  try {
+    _resetAt(&parser);
+    _rootBegin(&parser);
+
+    if (parser.withoutBraces && parser.ch != '"' && parser.ch != '\'' &&
+      _scanTail(TailState::FirstKey, parser.data, parser.indexNext - 1,
+      dataSize) != TailState::Failed)
+    {
+      // The input might be a single quoteless string instead of a map (see
+      // _rootEnd()). That can only be decided at the end, so parse it into a
+      // tree first. This only happens when the first line is followed by
+      // nothing but comments, or when a null char ends the scan early.
+      DecoderOptions treeOptions = options;
+      treeOptions.borrowInputBuffer = false;
+      treeOptions.arena = nullptr;
+      // Duplicate keys are not detected in this mode.
+      treeOptions.duplicateKeyException = false;
+      treeOptions.duplicateKeyHandler = nullptr;
+      auto root = Unmarshal(data, dataSize, treeOptions);
+      if (root.type() != Type::Map) {
+        _emitRootValue(handler, root);
+        return true;
+      }
+    }
+
+    _rootEnd(&parser);
+  } catch (const ParseStopped&) {
+    return false;
+  }
+
+  return true;
+}
+
+
+bool Unmarshal(const char *data, size_t dataSize, DecodeHandler& handler,
+  const DecoderOptions& options)
+{
+  if (options.comments || options.whitespaceAsComments) {
+    return _unmarshal<KeepComments>(data, dataSize, handler, options);
+  }
+
+  return _unmarshal<NoComments>(data, dataSize, handler, options);
+}
+
+
+bool Unmarshal(const std::string &data, DecodeHandler& handler,
+  const DecoderOptions& options)
+{
+  return Unmarshal(data.c_str(), data.size(), handler, options);
+}
+
+
+// Same handling of file endings as for files read in text mode.
+static size_t _trimFileEnd(const char *data, size_t len) {
+  while (len > 0 && data[len - 1] == '\0') {
+    --len;
+  }
+
+  if (len > 0 && data[len - 1] == '\n') {
+    --len;
+  }
+  if (len > 0 && data[len - 1] == '\r') {
+    --len;
+  }
+
+  return len;
+}
+
+
+#if HJSON_USE_MMAP
+// Read-only memory mapping of an entire file, unmapped when destroyed.
+class FileMapping {
+public:
+  FileMapping(void *_addr, size_t _size) : addr(_addr), size(_size) {}
+  ~FileMapping() { munmap(addr, size); }
+
+  void *addr;
+  size_t size;
+};
+#endif
+
+
+// Memory-maps or reads the entire file (in binary mode). Sets *pData and
+// *pSize to the contents (see _trimFileEnd()), and returns the owner that
+// keeps them alive.
+static std::shared_ptr<const void> _loadFile(const std::string &path,
+  const char **pData, size_t *pSize)
+{
+#if HJSON_USE_MMAP
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw file_error("Could not open file '" + path + "' for reading");
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    throw file_error("Could not open file '" + path + "' for reading");
+  }
+
+  size_t len = static_cast<size_t>(st.st_size);
+  // mmap() fails for empty files, and for files that cannot be mapped (like
+  // pipes) the regular read below is used instead.
+  void *addr = (len > 0 && S_ISREG(st.st_mode)) ?
+    mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+  close(fd);
+
+  if (addr != MAP_FAILED) {
+    auto mapping = std::make_shared<FileMapping>(addr, len);
+#ifdef MADV_SEQUENTIAL
+    madvise(addr, len, MADV_SEQUENTIAL);
+#endif
+    *pData = static_cast<const char*>(addr);
+    *pSize = _trimFileEnd(*pData, len);
+
+    return mapping;
+  }
+#endif
+
+  std::ifstream infile(path, std::ifstream::ate | std::ifstream::binary);
+  if (!infile.is_open()) {
+    throw file_error("Could not open file '" + path + "' for reading");
+  }
+  auto inStr = std::make_shared<std::string>();
+  inStr->resize(infile.tellg());
+  infile.seekg(0, std::ios::beg);
+  infile.read(&(*inStr)[0], inStr->size());
+  infile.close();
+
+  *pData = inStr->c_str();
+  *pSize = _trimFileEnd(inStr->c_str(), inStr->size());
+
+  return inStr;
+}
+
+
+Value UnmarshalFromFile(const std::string &path, const DecoderOptions& options) {
+  const char *data;
+  size_t dataSize;
+  auto owner = _loadFile(path, &data, &dataSize);
+
+  return _unmarshal(data, dataSize, options, std::move(owner));
+}
+
+
+// keyPos of a LazyNode that is not a map element.
+static const size_t _noKey = static_cast<size_t>(-1);
+
+
+// A map element, vector element or root value in the structural index of a
+// LazyValue::Document. The elements of a map or vector follow right after
+// its node, each one followed by its own elements.
+class LazyNode {
+public:
+  // The position of the key name, or _noKey if this is not a map element.
+  size_t keyPos;
+  // The position of the first char of the value.
+  size_t valuePos;
+  // The index of the node after this node and all of its elements.
+  std::uint32_t next;
+  // The number of elements, if the value is a map or a vector.
+  std::uint32_t count;
+};
+
+
+// Creates the structural index of the root map or vector that starts at
+// rootBegin. Strings, comments and quoteless values are skipped using the same
+// rules as the parser, see _scanSplits(). Returns false if the input contains
+// something that the parser would not accept, a zero byte or too many
+// elements, but does not find errors inside strings and key names.
+static bool _scanNodes(const unsigned char *data, size_t dataSize,
+  size_t rootBegin, bool withoutBraces, std::vector<LazyNode> *pNodes)
+{
+  auto& nodes = *pNodes;
+  nodes.push_back(LazyNode{ _noKey, rootBegin, 0, 0 });
+  // The nodes of the open maps and vectors.
+  std::vector<std::uint32_t> stack(1, 0);
+  size_t pos = withoutBraces ? rootBegin : rootBegin + 1;
+
+  for (;;) {
+    // At the start of an element or at the end of the container.
+    pos = _scanPastWhite(data, pos, dataSize);
+    std::uint32_t parent = stack.back();
+    bool isMap = (stack.size() == 1 && withoutBraces) ||
+      data[nodes[parent].valuePos] == '{';
+
+    if (pos >= dataSize) {
+      if (stack.size() == 1 && withoutBraces) {
+        nodes[0].next = static_cast<std::uint32_t>(nodes.size());
+        return true;
+      }
+      return false;
+    }
+
+    unsigned char c = data[pos];
+    if (c == 0) {
+      return false;
+    }
+
+    if (c == (isMap ? '}' : ']') && !(stack.size() == 1 && withoutBraces)) {
+      ++pos;
+      nodes[parent].next = static_cast<std::uint32_t>(nodes.size());
+      stack.pop_back();
+      if (stack.empty()) {
+        // Only whitespace and comments can follow the root.
+        pos = _scanPastWhite(data, pos, dataSize);
+        return pos >= dataSize || data[pos] == 0;
+      }
+    } else {
+      if (nodes.size() >= std::numeric_limits<std::uint32_t>::max()) {
+        return false;
+      }
+
+      size_t keyPos = _noKey;
+      if (isMap) {
+        keyPos = pos;
+        pos = _scanPastKey(data, pos, dataSize);
+        if (pos >= dataSize) {
+          return false;
+        }
+        pos = _scanPastWhite(data, pos + 1, dataSize);
+        if (pos >= dataSize || data[pos] == 0) {
+          return false;
+        }
+        c = data[pos];
+      }
+
+      ++nodes[parent].count;
+      nodes.push_back(LazyNode{ keyPos, pos,
+        static_cast<std::uint32_t>(nodes.size() + 1), 0 });
+
+      if (c == '{' || c == '[') {
+        stack.push_back(static_cast<std::uint32_t>(nodes.size() - 1));
+        ++pos;
+        continue;
+      } else if (c == '"' || c == '\'') {
+        pos = _scanPastString(data, pos, dataSize, true);
+        if (pos > dataSize) {
+          return false;
+        }
+      } else if (_isPunctuatorChar(c)) {
+        return false;
+      } else {
+        pos = _scanPastTfnns(data, pos, dataSize);
+      }
+    }
+
+    // After a value, the comma is optional.
+    pos = _scanPastWhite(data, pos, dataSize);
+    if (pos < dataSize && data[pos] == ',') {
+      ++pos;
+    }
+  }
+}
+
+
+class LazyValue::Document {
+public:
+  // The elements of a map or vector, created when it is first accessed by
+  // key or index.
+  class Index {
+  public:
+    typedef std::map<std::string, std::uint32_t> KeyMap;
+
+    // The nodes of the map elements by key name. For a duplicate key the
+    // last element is used, as by Unmarshal().
+    KeyMap byKey;
+    // The map elements in the order of the first occurrence of each key.
+    std::vector<KeyMap::const_iterator> keys;
+    // The nodes of the vector elements.
+    std::vector<std::uint32_t> elems;
+  };
+
+  Document(const char *data, size_t dataSize, const DecoderOptions& options,
+    const std::shared_ptr<const void>& bufferOwner);
+
+  // Scans the input. Returns false if the root is a single value, or if the
+  // input must be decoded to find out if it is valid.
+  bool scan();
+  bool isMap(size_t node) const;
+  bool isVector(size_t node) const;
+  const Index& index(size_t node);
+  template<class Policy>
+  Value decode(size_t node) const;
+  Value decode(size_t node) const;
+
+  const char *data;
+  size_t dataSize;
+  DecoderOptions opt;
+  std::shared_ptr<const void> bufferOwner;
+  const char *commentData;
+  std::shared_ptr<const void> commentOwner;
+  bool withoutBraces;
+  std::vector<LazyNode> nodes;
+  std::mutex indexMutex;
+  std::map<size_t, std::unique_ptr<Index> > indexes;
+};
+
+
+LazyValue::Document::Document(const char *_data, size_t _dataSize,
+  const DecoderOptions& options,
+  const std::shared_ptr<const void>& _bufferOwner)
+  : data(_data), dataSize(_dataSize), opt(options), bufferOwner(_bufferOwner),
+  commentData(nullptr), withoutBraces(false)
+{
+  if (opt.whitespaceAsComments) {
+    opt.comments = true;
+  }
+  // Only the whole input could be filtered.
+  opt.keyPaths.clear();
+
+  // The same comment storage as from _setInput(), but the copy of the input
+  // is only made once for all decoded values. Comments only refer to the
+  // input itself if borrowInputBuffer is set, because the input can be a
+  // memory-mapped file that may change after the LazyValue is gone.
+  if (opt.borrowInputBuffer) {
+    commentData = data;
+    commentOwner = bufferOwner;
+  } else if (opt.whitespaceAsComments && dataSize) {
+    std::shared_ptr<char> copy(new char[dataSize],
+      std::default_delete<char[]>());
+    std::memcpy(copy.get(), data, dataSize);
+    commentData = copy.get();
+    commentOwner = std::move(copy);
+  }
+}
+
+
+bool LazyValue::Document::scan() {
+  BasicParser<NoComments> parser = {
+    (const unsigned char*) data,
+    dataSize,
+    0,
+    ' ',
+    false,
+    opt
+  };
+
+  _resetAt(&parser);
+  _rootBegin(&parser);
+  if (parser.singleValue) {
+    return false;
+  }
+
+  size_t rootBegin = std::min(static_cast<size_t>(parser.indexNext - 1),
+    dataSize);
+  withoutBraces = parser.withoutBraces;
+  if (withoutBraces && parser.ch != '"' && parser.ch != '\'' &&
+    _scanTail(TailState::FirstKey, parser.data, rootBegin, dataSize) !=
+    TailState::Failed)
+  {
+    // Could be a single quoteless string instead of a map, see _rootEnd().
+    return false;
+  }
+
+  return _scanNodes(parser.data, dataSize, rootBegin, withoutBraces, &nodes);
+}
+
+
+bool LazyValue::Document::isMap(size_t node) const {
+  return (node == 0 && withoutBraces) || data[nodes[node].valuePos] == '{';
+}
+
+
+bool LazyValue::Document::isVector(size_t node) const {
+  return !(node == 0 && withoutBraces) && data[nodes[node].valuePos] == '[';
+}
+
+
+const LazyValue::Document::Index& LazyValue::Document::index(size_t node) {
+  std::lock_guard<std::mutex> lock(indexMutex);
+  auto& index = indexes[node];
+  if (index) {
+    return *index;
+  }
+
+  std::unique_ptr<Index> ret(new Index());
+  size_t elem = node + 1;
+
+  if (isMap(node)) {
+    BasicParser<NoComments> parser = {
+      (const unsigned char*) data,
+      dataSize,
+      0,
+      ' ',
+      false,
+      opt
+    };
+
+    for (size_t i = 0; i < nodes[node].count; ++i) {
+      _setIndex(&parser, nodes[elem].keyPos);
+      auto key = _readKeyname(&parser);
+      size_t keyEnd = parser.indexNext - 1;
+      auto res = ret->byKey.insert(std::make_pair(std::move(key),
+        static_cast<std::uint32_t>(elem)));
+      if (res.second) {
+        ret->keys.push_back(res.first);
+      } else if (opt.duplicateKeyException) {
+        _setIndex(&parser, keyEnd);
+        throw syntax_error(_errAt(&parser, "Found duplicate of key '" +
+          res.first->first + "'"));
+      } else {
+        res.first->second = static_cast<std::uint32_t>(elem);
+      }
+      elem = nodes[elem].next;
+    }
+  } else {
+    ret->elems.reserve(nodes[node].count);
+    for (size_t i = 0; i < nodes[node].count; ++i) {
+      ret->elems.push_back(static_cast<std::uint32_t>(elem));
+      elem = nodes[elem].next;
+    }
+  }
+
+  index = std::move(ret);
+
+  return *index;
+}
+
+
+template<class Policy>
+Value LazyValue::Document::decode(size_t node) const {
+  BasicParser<Policy> parser = {
+    nullptr,
+    0,
+    0,
+    ' ',
+    false,
+    opt
+  };
+
+  if (node == 0) {
+    return _decode(&parser, data, dataSize, bufferOwner);
+  }
+
+  parser.data = (const unsigned char*) data;
+  parser.dataSize = dataSize;
+  parser.bufferOwner = bufferOwner;
+  parser.commentData = commentData;
+  parser.commentOwner = commentOwner;
+
+  _setIndex(&parser, nodes[node].valuePos);
+  parser.vState.push_back(ParseState::ValueBegin);
+  _parseLoop(&parser);
+
+  Value ret = std::move(parser.vParent.back().val);
+  if (nodes[node].keyPos != _noKey) {
+    ret.set_pos_key(nodes[node].keyPos);
+  }
+
+  return ret;
+}
+
+
+Value LazyValue::Document::decode(size_t node) const {
+  if (opt.comments) {
+    return decode<KeepComments>(node);
+  }
+
+  return decode<NoComments>(node);
+}
+
+
+LazyValue openLazyValue(const char *data, size_t dataSize,
+  const DecoderOptions& options, const std::shared_ptr<const void>& bufferOwner)
+{
+  if (!options.duplicateKeyHandler) {
+    std::shared_ptr<LazyValue::Document> doc(new LazyValue::Document(data,
+      dataSize, options, bufferOwner));
+    if (doc->scan()) {
+      return LazyValue(std::move(doc), 0);
+    }
+  }
+
+  // Decoded right away, which also gives the right error message if the
+  // input is invalid.
+  return LazyValue(_unmarshal(data, dataSize, options, bufferOwner));
+}
+
+
+LazyValue::LazyValue()
+  : node(0)
+{
+}
+
+
+LazyValue::LazyValue(std::shared_ptr<Document> _doc, size_t _node)
+  : doc(std::move(_doc)), node(_node)
+{
+}
+
+
+LazyValue::LazyValue(const Value& _val)
+  : node(0), val(_val)
+{
+}
+
+
+Type LazyValue::type() const {
+  if (!doc) {
+    return val.type();
+  } else if (doc->isMap(node)) {
+    return Type::Map;
+  } else if (doc->isVector(node)) {
+    return Type::Vector;
+  }
+
+  return doc->decode<NoComments>(node).type();
+}
+
+
+bool LazyValue::defined() const {
+  return doc || val.defined();
+}
+
+
+bool LazyValue::empty() const {
+  if (!doc) {
+    return val.empty();
+  } else if (doc->isMap(node) || doc->isVector(node)) {
+    return doc->nodes[node].count == 0;
+  }
+
+  return doc->decode<NoComments>(node).empty();
+}
+
+
+size_t LazyValue::size() const {
+  if (!doc) {
+    return val.size();
+  } else if (doc->isMap(node)) {
+    return doc->index(node).keys.size();
+  } else if (doc->isVector(node)) {
+    return doc->nodes[node].count;
+  }
+
+  return 0;
+}
+
+
+LazyValue LazyValue::operator[](const std::string& name) const {
+  if (!doc) {
+    return LazyValue(val[name]);
+  } else if (!doc->isMap(node)) {
+    throw type_mismatch("Must be of type Undefined or Map for that operation.");
+  }
+
+  auto& index = doc->index(node);
+  auto it = index.byKey.find(name);
+  if (it == index.byKey.end()) {
+    return LazyValue();
+  }
+
+  return LazyValue(doc, it->second);
+}
+
+
+LazyValue LazyValue::operator[](const char *name) const {
+  return operator[](std::string(name));
+}
+
+
+LazyValue LazyValue::operator[](int index) const {
+  if (!doc) {
+    return LazyValue(val[index]);
+  } else if (!doc->isMap(node) && !doc->isVector(node)) {
+    throw type_mismatch("Must be of type Undefined, Vector or Map for that operation.");
+  }
+
+  auto& elems = doc->index(node);
+  if (index < 0 || (size_t)index >= (doc->isMap(node) ? elems.keys.size() :
+    elems.elems.size()))
+  {
+    throw index_out_of_bounds("Index out of bounds.");
+  }
+
+  return LazyValue(doc, doc->isMap(node) ? elems.keys[index]->second :
+    elems.elems[index]);
+}
+
+
+std::string LazyValue::key(int index) const {
+  if (!doc) {
+    return val.key(index);
+  } else if (!doc->isMap(node)) {
+    throw type_mismatch("Must be of type Map for that operation.");
+  }
+
+  auto& elems = doc->index(node);
+  if (index < 0 || (size_t)index >= elems.keys.size()) {
+    throw index_out_of_bounds("Index out of bounds.");
+  }
+
+  return elems.keys[index]->first;
+}
+
+
+Value LazyValue::to_value() const {
+  if (!doc) {
+    return val;
+  }
+
+  return doc->decode(node);
+}
+
+
+LazyValue UnmarshalLazy(const char *data, size_t dataSize,
+  const DecoderOptions& options)
+{
+  return openLazyValue(data, dataSize, options, nullptr);
+}
+
+
+LazyValue UnmarshalLazy(const std::string& data,
+  const DecoderOptions& options)
+{
+  auto copy = std::make_shared<std::string>(data);
+
+  return openLazyValue(copy->data(), copy->size(), options, copy);
+}
+
+
+LazyValue UnmarshalLazyFromFile(const std::string& path,
+  const DecoderOptions& options)
+{
+  const char *data;
+  size_t dataSize;
+  auto owner = _loadFile(path, &data, &dataSize);
+
+  return openLazyValue(data, dataSize, options, owner);
+}
+
+
+class PushDecoder::Impl {
+public:
+  Impl(const DecoderOptions&);
+
+  void reset();
+  void compact();
+  void scanTail();
+  bool mustKeepAll() const;
+  void parse();
+
+  DecoderOptions opt;
+  // The input that has not been parsed yet, from the start of the line.
+  std::string buf;
+  BasicParser<KeepComments> parser;
+  bool rootStarted;
+  // True if a syntax error was found that finish() must handle.
+  bool deferred;
+  // Do not parse again until buf is at least this big.
+  size_t retryAt;
+  TailState tail;
+  size_t tailPos;
+};
+
+
+PushDecoder::Impl::Impl(const DecoderOptions& _opt)
+  : opt(_opt)
+{
+  if (opt.whitespaceAsComments) {
+    opt.comments = true;
+  }
+  // The input buffer is reused and discarded while parsing.
+  opt.borrowInputBuffer = false;
+
+  reset();
+}
+
+
+void PushDecoder::Impl::reset() {
+  buf.clear();
+  parser = BasicParser<KeepComments>{
+    nullptr,
+    0,
+    0,
+    ' ',
+    false,
+    opt
+  };
+  parser.partial = true;
+  rootStarted = false;
+  deferred = false;
+  retryAt = 0;
+  tail = TailState::Failed;
+  tailPos = 0;
+}
+
+
+// Returns true if the input from the start must be kept for finish(), because
+// the root might be parsed again as a single value.
+bool PushDecoder::Impl::mustKeepAll() const {
+  return !rootStarted || parser.singleValue ||
+    (parser.withoutBraces && !parser.noFallback);
+}
+
+
+static void _compactComment(CommentInfo& ci, const std::string& buf,
+  size_t cut)
+{
+  if (!ci.hasComment || ci.text) {
+    return;
   }
-  
-  if (p->opt.duplicateKeyException && object[p->vParent.back().key].defined()) {
-    throw syntax_error(_errAt(p, "Found duplicate of key '" + p->vParent.back().key + "'"));
+
+  if ((size_t)ci.cmStart < cut) {
+    ci.text = std::make_shared<std::string>(buf.data() + ci.cmStart,
+      ci.cmEnd - ci.cmStart);
+  } else {
+    ci.cmStart -= static_cast<int>(cut);
+    ci.cmEnd -= static_cast<int>(cut);
   }
-  p->vParent.back().ciKey = _white(p);
-  if (p->ch != ':') {
-    throw syntax_error(_errAt(p, std::string(
-      "Expected ':' instead of '") + (char)(p->ch) + "'"));
+}
+
+
+// Discards the parsed input, except for the current line so that error
+// messages are the same as from Unmarshal(). Comments that are still needed
+// are copied.
+void PushDecoder::Impl::compact() {
+  if (mustKeepAll() || parser.indexNext < 1) {
+    return;
   }
-  _next(p);
-  p->vState.back() = ParseState::MapElemEnd;
-  p->vState.push_back(ParseState::ValueBegin);
+
+  size_t cut = buf.rfind('\n', parser.indexNext - 1);
+  if (cut == std::string::npos || cut == 0) {
+    return;
+  }
+
+  for (auto& dp : parser.vParent) {
+    _compactComment(dp.ciBefore, buf, cut);
+    _compactComment(dp.ciKey, buf, cut);
+    _compactComment(dp.ciElemBefore, buf, cut);
+    _compactComment(dp.ciElemExtra, buf, cut);
+  }
+
+  // The char at index 0 is never counted by _errAt().
+  parser.lineBase += static_cast<size_t>(std::count(buf.begin() + 1,
+    buf.begin() + cut + 1, '\n'));
+  parser.posBase += cut;
+  parser.indexNext -= static_cast<int>(cut);
+  retryAt = (retryAt > cut ? retryAt - cut : 0);
+  buf.erase(0, cut);
 }
 
 
-static void _readObjectElemEnd(Parser *p) {
-  Value elem = p->vParent.back().val;
-  p->vParent.pop_back();
-  _setComment(elem, &Value::set_comment_key, p, p->vParent.back().ciKey);
-  if (!elem.get_comment_before().empty()) {
-    elem.set_comment_key(elem.get_comment_key() +
-      elem.get_comment_before());
-    elem.set_comment_before("");
-  }
-  _setComment(elem, &Value::set_comment_before, p, p->vParent.back().ciElemBefore, p->vParent.back().ciElemExtra);
-  elem.set_pos_key(p->vParent.back().key_position);
-  auto ciAfter = _white(p);
+void PushDecoder::Impl::scanTail() {
+  tail = _scanTail(tail, reinterpret_cast<const unsigned char*>(buf.data()),
+    tailPos, buf.size());
+  tailPos = buf.size();
+}
 
-  // in Hjson the comma is optional and trailing commas are allowed
-  if (p->ch == ',') {
-    _next(p);
-    // It is unlikely that someone writes a comment after the value but
-    // before the comma, so we include any such comment in "comment_after".
-    p->vParent.back().ciElemExtra = _white(p);
-  } else {
-    p->vParent.back().ciElemExtra = {};
+
+// Runs as many parse steps as possible on the input in buf. A step that
+// reaches the end of buf is aborted by _commit(), and run again when more
+// input has arrived.
+void PushDecoder::Impl::parse() {
+  auto p = &parser;
+  p->data = reinterpret_cast<const unsigned char*>(buf.data());
+  p->dataSize = buf.size();
+
+  if (deferred || buf.size() < retryAt) {
+    return;
   }
 
-  if (p->ch == '}' && !(p->vParent.size() == 1 && p->withoutBraces)) {
-    auto existingAfter = elem.get_comment_after();
-    _setComment(elem, &Value::set_comment_after, p, ciAfter, p->vParent.back().ciElemExtra);
-    if (!existingAfter.empty()) {
-      elem.set_comment_after(existingAfter + elem.get_comment_after());
+  if (!rootStarted) {
+    p->overrun = false;
+    _resetAt(p);
+    _rootBegin(p);
+    if (p->overrun) {
+      p->vState.clear();
+      p->vParent.clear();
+      p->withoutBraces = false;
+      p->singleValue = false;
+      retryAt = buf.size() * 2;
+      return;
     }
-    p->vParent.back().val[p->vParent.back().key].assign_with_comments(std::move(elem));
-    _next(p);
-    p->vState.back() = ParseState::ValueEnd;
-  } else {
-    p->vParent.back().val[p->vParent.back().key].assign_with_comments(std::move(elem));
-    p->vParent.back().ciElemBefore = ciAfter;
-    p->vState.back() = ParseState::MapElemBegin;
+    rootStarted = true;
+    if (p->withoutBraces) {
+      if (p->ch == '"' || p->ch == '\'') {
+        // A quoted string followed by ':' cannot be a single value.
+        p->noFallback = true;
+      } else {
+        tail = TailState::FirstKey;
+        tailPos = p->indexNext - 1;
+      }
+    }
+  }
+
+  if (p->singleValue) {
+    // Parsed by finish(), the whole input is needed anyway.
+    return;
+  }
+
+  if (p->withoutBraces && !p->noFallback) {
+    scanTail();
+    if (tail == TailState::Failed) {
+      p->noFallback = true;
+    }
+  }
+
+  while (!p->vState.empty()) {
+    size_t stepStart = p->indexNext - 1;
+    p->overrun = false;
+    _setIndex(p, stepStart);
+
+    try {
+      _parseStep(p);
+      continue;
+    } catch (const InputNeeded&) {
+      // Avoid parsing the same input again for every small chunk.
+      retryAt = buf.size() + (buf.size() - stepStart);
+    } catch (const syntax_error&) {
+      if (p->overrun) {
+        retryAt = buf.size() + (buf.size() - stepStart);
+      } else if (p->withoutBraces && !p->noFallback) {
+        // The input might still be valid as a single value, let finish()
+        // decide.
+        deferred = true;
+      } else {
+        throw;
+      }
+    }
+
+    // The step did not change the parse state, run it again later.
+    _setIndex(p, stepStart);
+    return;
   }
 }
 
 
-// Parse a Hjson value. It could be an object, an array, a string, a number or a word.
-static void _readValueBegin(Parser *p) {
-  p->vParent.push_back(DecodeParent());
-  p->vParent.back().ciBefore = _white(p);
-  size_t pos = p->indexNext - 1;
-  Value val;
+PushDecoder::PushDecoder(const DecoderOptions& options)
+  : impl(new Impl(options))
+{
+}
 
-  switch (p->ch) {
-  case '{':
-    p->vState.back() = ParseState::MapBegin;
-    break;
-  case '[':
-    p->vState.back() =  ParseState::VectorBegin;
-    break;
-  case '"':
-  case '\'':
-    val = _readString(p, true);
-    val.set_pos_item(pos);
-    p->vParent.back().val.assign_with_comments(std::move(val));
-    p->vState.back() = ParseState::ValueEnd;
-    break;
-  default:
-    p->vParent.back().val.assign_with_comments(_readTfnns(p));
-    p->vState.back() = ParseState::ValueEnd;
-    break;
+
+PushDecoder::~PushDecoder() {
+}
+
+
+void PushDecoder::feed(const char *data, size_t dataSize) {
+  try {
+    impl->compact();
+    impl->buf.append(data, dataSize);
+    impl->parse();
+  } catch (...) {
+    impl->reset();
+    throw;
   }
 }
 
 
-static void _readValueEnd(Parser *p) {
-  auto ciAfter = _getCommentAfter(p);
+Value PushDecoder::finish() {
+  auto p = &impl->parser;
 
-  _setComment(p->vParent.back().val, &Value::set_comment_before, p, p->vParent.back().ciBefore);
-  _setComment(p->vParent.back().val, &Value::set_comment_after, p, ciAfter);
+  try {
+    p->data = reinterpret_cast<const unsigned char*>(impl->buf.data());
+    p->dataSize = impl->buf.size();
+    p->partial = false;
 
-  p->vState.pop_back();
+    if (impl->rootStarted) {
+      _setIndex(p, p->indexNext - 1);
+    } else {
+      _resetAt(p);
+      _rootBegin(p);
+    }
+
+    Value ret = _rootEnd(p);
+    impl->reset();
+
+    return ret;
+  } catch (...) {
+    impl->reset();
+    throw;
+  }
 }
 
 
-static Value _hasTrailing(Parser *p, CommentInfo *ci) {
-  *ci = _white(p);
-  return p->ch > 0;
+// The input of a DocumentReader is parsed through a window, which starts at
+// the line feed before the next document (or at the start of the input) so
+// that _errAt() reports the same line and column numbers as for the whole
+// input. The window grows when a document does not fit in it.
+class DocumentReader::Impl : public ReusableParser {
+public:
+  explicit Impl(const DecoderOptions&);
+
+  template<class Parser>
+  bool read(Parser *p, Value& doc);
+  void more();
+  void moveTo(size_t pos);
+  void skipRecord(size_t from);
+
+  // The input, or for a stream the part of it that has been read but not
+  // discarded yet.
+  const char *base;
+  size_t baseSize;
+  // The position of base[0] in the input.
+  size_t basePos;
+  // True if base ends where the input ends.
+  bool atEnd;
+  // If not null, more input is read from here into buf when needed.
+  std::istream *in;
+  std::unique_ptr<std::istream> file;
+  std::string buf;
+  // Kept alive by borrowed strings and comments, can be null.
+  std::shared_ptr<const void> bufferOwner;
+  // The window starts at base[winStart], lineBase is the number of line
+  // feeds in the input before that (not counting the first char of the
+  // input). Unless reading from a stream, the window ends winLen chars after
+  // cur.
+  size_t winStart, winLen, lineBase;
+  // Where the next document is searched for.
+  size_t cur;
+  // See doc_begin() and doc_end().
+  size_t docBegin, docEnd;
+  // The mapped memory before this position has been given back to the system.
+  size_t released;
+  bool mapped;
+};
+
+
+static const size_t _minWindowSize = 64 * 1024;
+// Leaves room for the int positions in the parser.
+static const size_t _maxWindowSize = static_cast<size_t>(
+  std::numeric_limits<int>::max() / 2);
+
+
+DocumentReader::Impl::Impl(const DecoderOptions& options)
+  : ReusableParser(options),
+    base(nullptr),
+    baseSize(0),
+    basePos(0),
+    atEnd(true),
+    in(nullptr),
+    winStart(0),
+    winLen(_minWindowSize),
+    lineBase(0),
+    cur(0),
+    docBegin(0),
+    docEnd(0),
+    released(0),
+    mapped(false)
+{
 }
 
 
-static void _parseLoop(Parser* p) {
-  while (!p->vState.empty()) {
-    switch (p->vState.back()) {
-    case ParseState::ValueBegin:
-      _readValueBegin(p);
-      break;
-    case ParseState::ValueEnd:
-      _readValueEnd(p);
-      break;
-    case ParseState::MapBegin:
-      _readObjectBegin(p);
-      break;
-    case ParseState::MapElemBegin:
-      _readObjectElemBegin(p);
-      break;
-    case ParseState::MapElemEnd:
-      _readObjectElemEnd(p);
-      break;
-    case ParseState::VectorBegin:
-      _readArrayBegin(p);
-      break;
-    case ParseState::VectorElemEnd:
-      _readArrayElemEnd(p);
-      break;
+// Makes more input available to the window.
+void DocumentReader::Impl::more() {
+  if (!in) {
+    if (winLen >= _maxWindowSize) {
+      throw syntax_error("Document too large at position " +
+        std::to_string(basePos + cur));
     }
+    winLen *= 2;
+    return;
+  }
+
+  // The input before the window is no longer needed.
+  buf.erase(0, winStart);
+  basePos += winStart;
+  cur -= winStart;
+  winStart = 0;
+
+  if (buf.size() >= _maxWindowSize) {
+    throw syntax_error("Document too large at position " +
+      std::to_string(basePos + cur));
   }
+
+  // At least double the size, so that each document is parsed again only a
+  // few times.
+  size_t oldSize = buf.size();
+  buf.resize(oldSize + std::max(_minWindowSize, oldSize));
+  std::streamsize n = in->rdbuf() ? in->rdbuf()->sgetn(&buf[oldSize],
+    static_cast<std::streamsize>(buf.size() - oldSize)) : 0;
+  buf.resize(oldSize + static_cast<size_t>(std::max(n, std::streamsize(0))));
+  if (n <= 0) {
+    atEnd = true;
+  }
+
+  base = buf.data();
+  baseSize = buf.size();
 }
 
 
-// Braces for the root object are optional
-static Value _rootValue(Parser *p) {
-  CommentInfo ciExtra;
+// Moves forward to pos, and moves the start of the window to the last line
+// feed before pos.
+void DocumentReader::Impl::moveTo(size_t pos) {
+  // There are no line feeds between winStart and cur.
+  const char *s = base + std::max(cur, winStart + 1);
+  const char *e = base + pos;
+  while (s < e && (s = static_cast<const char*>(std::memchr(s, '\n', e - s)))) {
+    ++lineBase;
+    winStart = s - base;
+    ++s;
+  }
+  if (pos - winStart > _maxWindowSize / 2) {
+    // A very long line, the column numbers in error messages will be
+    // counted from here instead.
+    winStart = pos;
+  }
+  cur = pos;
+
+#if HJSON_USE_MMAP
+  if (mapped && winStart - released >= 64 * _minWindowSize) {
+    size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t releaseEnd = winStart - winStart % pageSize;
+    // The mapping is read-only, the pages are read from the file again if
+    // a borrowed string needs them.
+    madvise(const_cast<char*>(base) + released, releaseEnd - released,
+      MADV_DONTNEED);
+    released = releaseEnd;
+  }
+#endif
+}
 
-  p->vParent.push_back(DecodeParent());
-  p->vParent.back().isRoot = true;
-  p->vParent.back().ciBefore = _white(p);
 
-  if (p->ch == '[') {
-    p->vState.push_back(ParseState::VectorBegin);
-  } else {
-    if (p->ch != '{') {
-      // Assume root object without braces
-      p->withoutBraces = true;
+// Moves forward to the next line after "from" that starts with '{' or '['.
+void DocumentReader::Impl::skipRecord(size_t from) {
+  for (;;) {
+    const char *s = base + from;
+    const char *e = base + baseSize;
+    while (s + 1 < e && (s = static_cast<const char*>(std::memchr(s, '\n',
+      e - s - 1))))
+    {
+      if (s[1] == '{' || s[1] == '[') {
+        moveTo(s + 1 - base);
+        return;
+      }
+      ++s;
     }
-    p->vState.push_back(ParseState::MapBegin);
+
+    if (!in || atEnd) {
+      moveTo(baseSize);
+      return;
+    }
+    // The last char could be a line feed before the next document.
+    moveTo(std::max(cur, baseSize - 1));
+    more();
+    from = cur;
   }
+}
 
-  try {
-    _parseLoop(p);
-    if (_hasTrailing(p, &ciExtra)) {
-      throw syntax_error(_errAt(p, "Syntax error, found trailing characters"));
+
+template<class Parser>
+bool DocumentReader::Impl::read(Parser *p, Value& doc) {
+  for (;;) {
+    size_t winEnd = (in ? baseSize : std::min(baseSize, cur + winLen));
+    p->data = reinterpret_cast<const unsigned char*>(base) + winStart;
+    p->dataSize = winEnd - winStart;
+    p->partial = (winEnd < baseSize || !atEnd);
+    p->overrun = false;
+    p->posBase = basePos + winStart;
+    p->lineBase = lineBase;
+    if (p->opt.borrowInputBuffer) {
+      p->bufferOwner = bufferOwner;
+      p->commentData = base + winStart;
+      p->commentOwner = bufferOwner;
     }
-  } catch (const syntax_error& e1) {
-    if (p->withoutBraces) {
-      // test if we are dealing with a single JSON value instead (true/false/null/num/"")
-      _resetAt(p);
+    p->vState.clear();
+    p->vParent.clear();
+    size_t begin = cur;
+
+    try {
+      _setIndex(p, cur - winStart);
+      p->vParent.push_back(typename Parser::Parent());
+      p->vParent.back().isRoot = true;
+      p->vParent.back().ciBefore = _white(p);
+      _filterRoot(p);
+      begin = winStart + p->indexNext - 1;
+
+      if (p->ch == 0) {
+        _commit(p);
+        docBegin = docEnd = basePos + begin;
+        return false;
+      } else if (p->ch == '{') {
+        p->vState.push_back(ParseState::MapBegin);
+      } else if (p->ch == '[') {
+        p->vState.push_back(ParseState::VectorBegin);
+      } else {
+        throw syntax_error(_errAt(p, std::string(
+          "Expected '{' or '[' instead of '") + (char)(p->ch) + "'"));
+      }
+
+      // Parse until the root has been closed, then get the comment after it.
+      while (p->vState.size() > 1 || p->vState.back() != ParseState::ValueEnd) {
+        _parseStep(p);
+      }
+      size_t end = winStart + p->indexNext - 1;
+      _parseStep(p);
+
+      doc.assign_with_comments(std::move(p->vParent.back().val));
       p->vParent.clear();
-      p->vState.clear();
-      p->vState.push_back(ParseState::ValueBegin);
-      try {
-        _parseLoop(p);
-        if (_hasTrailing(p, &ciExtra)) {
-          throw syntax_error(_errAt(p, "Syntax error, found trailing characters"));
-        }
-      } catch (const syntax_error&) {
-        throw e1;
+      docBegin = basePos + begin;
+      docEnd = basePos + end;
+      moveTo(winStart + p->indexNext - 1);
+
+      return true;
+    } catch (const InputNeeded&) {
+      more();
+    } catch (const syntax_error&) {
+      if (p->overrun && p->partial) {
+        // Might be valid, or get a different message, with more input.
+        more();
+        continue;
       }
-    } else {
-      throw e1;
+      p->vParent.clear();
+      docBegin = basePos + begin;
+      skipRecord(begin + 1);
+      docEnd = basePos + cur;
+      throw;
     }
   }
+}
 
-  Value ret = p->vParent.back().val;
-  if (ciExtra.hasComment) {
-    auto existingAfter = ret.get_comment_after();
-    _setComment(ret, &Value::set_comment_after, p, ciExtra);
-    if (!existingAfter.empty()) {
-      ret.set_comment_after(existingAfter + ret.get_comment_after());
-    }
-  }
 
-  return ret;
+DocumentReader::DocumentReader(const char *data, size_t dataSize,
+  const DecoderOptions& options)
+  : impl(new Impl(options))
+{
+  impl->base = data;
+  impl->baseSize = dataSize;
 }
 
 
-// Unmarshal parses the Hjson-encoded data and returns a tree of Values.
-//
-// Unmarshal uses the inverse of the encodings that Marshal uses.
-//
-Value Unmarshal(const char *data, size_t dataSize, const DecoderOptions& options) {
-  Parser parser = {
-    (const unsigned char*) data,
-    dataSize,
-    0,
-    ' ',
-    false,
-    options
-  };
+DocumentReader::DocumentReader(std::istream& in, const DecoderOptions& options)
+  : impl(new Impl(options))
+{
+  impl->in = &in;
+  impl->atEnd = false;
+  // The input buffer is reused and discarded while parsing.
+  (impl->cmParser ? impl->cmParser->opt : impl->parser->opt).borrowInputBuffer =
+    false;
+}
 
-  if (parser.opt.whitespaceAsComments) {
-    parser.opt.comments = true;
-  }
 
-  _resetAt(&parser);
-  return _rootValue(&parser);
+DocumentReader::DocumentReader(std::unique_ptr<Impl> _impl)
+  : impl(std::move(_impl))
+{
 }
 
 
-Value Unmarshal(const char *data, const DecoderOptions& options) {
-  if (!data) {
-    return Value();
-  }
+DocumentReader::DocumentReader(DocumentReader&&) = default;
 
-  return Unmarshal(data, std::strlen(data), options);
+
+DocumentReader::~DocumentReader() {
 }
 
 
-Value Unmarshal(const std::string &data, const DecoderOptions& options) {
-  return Unmarshal(data.c_str(), data.size(), options);
-}
+DocumentReader& DocumentReader::operator=(DocumentReader&&) = default;
 
 
-Value UnmarshalFromFile(const std::string &path, const DecoderOptions& options) {
-  std::ifstream infile(path, std::ifstream::ate | std::ifstream::binary);
-  if (!infile.is_open()) {
+DocumentReader DocumentReader::open_file(const std::string& path,
+  const DecoderOptions& options)
+{
+#if HJSON_USE_MMAP
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
     throw file_error("Could not open file '" + path + "' for reading");
   }
-  std::string inStr;
-  size_t len = infile.tellg();
-  inStr.resize(len);
-  infile.seekg(0, std::ios::beg);
-  infile.read(&inStr[0], inStr.size());
-  infile.close();
 
-  while (len > 0 && inStr.at(len - 1) == '\0') {
-    --len;
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    throw file_error("Could not open file '" + path + "' for reading");
   }
 
-  if (len > 0 && inStr.at(len - 1) == '\n') {
-    --len;
+  size_t len = static_cast<size_t>(st.st_size);
+  void *addr = (len > 0 && S_ISREG(st.st_mode)) ?
+    mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+  close(fd);
+
+  if (addr != MAP_FAILED) {
+#ifdef MADV_SEQUENTIAL
+    madvise(addr, len, MADV_SEQUENTIAL);
+#endif
+    const char *data = static_cast<const char*>(addr);
+    DocumentReader reader(data, _trimFileEnd(data, len), options);
+    reader.impl->bufferOwner = std::make_shared<FileMapping>(addr, len);
+    reader.impl->mapped = true;
+
+    return reader;
   }
-  if (len > 0 && inStr.at(len - 1) == '\r') {
-    --len;
+#endif
+
+  std::unique_ptr<std::istream> file(new std::ifstream(path,
+    std::ifstream::binary));
+  if (!static_cast<std::ifstream*>(file.get())->is_open()) {
+    throw file_error("Could not open file '" + path + "' for reading");
+  }
+  DocumentReader reader(*file, options);
+  reader.impl->file = std::move(file);
+
+  return reader;
+}
+
+
+bool DocumentReader::next(Value& doc) {
+  if (impl->cmParser) {
+    return impl->read(impl->cmParser.get(), doc);
   }
 
-  return Unmarshal(inStr.c_str(), len, options);
+  return impl->read(impl->parser.get(), doc);
+}
+
+
+size_t DocumentReader::doc_begin() const {
+  return impl->docBegin;
+}
+
+
+size_t DocumentReader::doc_end() const {
+  return impl->docEnd;
 }
 
 
@@ -895,9 +4016,16 @@ StreamDecoder::StreamDecoder(Value& _v, const DecoderOptions& _o)
 
 
 std::istream &operator >>(std::istream& in, StreamDecoder& sd) {
-  std::string inStr{ std::istreambuf_iterator<char>(in),
-    std::istreambuf_iterator<char>() };
-  sd.v.assign_with_comments(Unmarshal(inStr, sd.o));
+  PushDecoder decoder(sd.o);
+
+  if (in.rdbuf()) {
+    char chunk[16 * 1024];
+    std::streamsize n;
+    while ((n = in.rdbuf()->sgetn(chunk, sizeof(chunk))) > 0) {
+      decoder.feed(chunk, static_cast<size_t>(n));
+    }
+  }
+  sd.v.assign_with_comments(decoder.finish());
 
   return in;
 }
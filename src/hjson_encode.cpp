@@ -6,6 +6,7 @@
 #include <fstream>
 #include <cmath>
 #include <cctype>
+#include <algorithm>
 
 
 namespace Hjson {
@@ -26,7 +27,9 @@ public:
   int index;
   bool isEmpty;
   std::string commentAfter;
-  Value::ValueMap::const_iterator it;
+  // The elements of a map in alphabetical key order, if the insertion order
+  // is not preserved.
+  std::vector<Value::ValueMap::const_iterator> sorted;
 };
 
 
@@ -378,7 +381,19 @@ static void _writeValueBegin(Encoder *e) {
       e->indent++;
     }
     e->vParent.back().commentAfter = value.get_comment_inside();
-    e->vParent.back().it = value.begin();
+    if (!e->opt.preserveInsertionOrder) {
+      auto& sorted = e->vParent.back().sorted;
+      sorted.reserve(value.size());
+      for (auto it = value.begin(); it != value.end(); ++it) {
+        sorted.push_back(it);
+      }
+      std::sort(sorted.begin(), sorted.end(),
+        [](Value::ValueMap::const_iterator a,
+          Value::ValueMap::const_iterator b)
+        {
+          return a->first < b->first;
+        });
+    }
     e->vState.back() = EncodeState::MapElemBegin;
     return;
 
@@ -531,13 +546,15 @@ static void _writeMapElemBegin(Encoder *e) {
   const Value &value = *ep.pVal;
 
   if (e->opt.preserveInsertionOrder) {
+    auto elems = value.begin();
     for (; (size_t)ep.index < value.size(); ++ep.index) {
-      const Value &elem = value[ep.index];
+      const std::string &key = elems[ep.index].first;
+      const Value &elem = elems[ep.index].second;
       if (elem.defined()) {
         int oldParentIndex = e->vParent.size() - 1;
 
         // Invalidates ep
-        _objElem(e, value.key(ep.index), elem, &ep.isEmpty, ep.commentAfter);
+        _objElem(e, key, elem, &ep.isEmpty, ep.commentAfter);
 
         e->vParent[oldParentIndex].commentAfter = elem.get_comment_after();
         ++e->vParent[oldParentIndex].index;
@@ -545,16 +562,17 @@ static void _writeMapElemBegin(Encoder *e) {
       }
     }
   } else {
-    for (; ep.it != value.end(); ++ep.it) {
-      if (ep.it->second.defined()) {
+    for (; (size_t)ep.index < ep.sorted.size(); ++ep.index) {
+      auto it = ep.sorted[ep.index];
+      if (it->second.defined()) {
         int oldParentIndex = e->vParent.size() - 1;
-        auto oldIt = ep.it;
 
         // Invalidates ep
-        _objElem(e, oldIt->first, oldIt->second, &ep.isEmpty, ep.commentAfter);
+        _objElem(e, it->first, it->second, &ep.isEmpty, ep.commentAfter);
 
-        e->vParent[oldParentIndex].commentAfter = oldIt->second.get_comment_after();
-        ++e->vParent[oldParentIndex].it;
+        e->vParent[oldParentIndex].commentAfter =
+          it->second.get_comment_after();
+        ++e->vParent[oldParentIndex].index;
         return;
       }
     }
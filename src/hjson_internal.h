@@ -0,0 +1,59 @@
+#ifndef HJSON_INTERNAL_OWIEFNAOWEINFAWL
+#define HJSON_INTERNAL_OWIEFNAOWEINFAWL
+
+#include "hjson.h"
+
+
+namespace Hjson {
+
+
+// Access to the internals of Value for the decoder. This header is not
+// installed, so none of this is part of the public API.
+class ValueInternal {
+public:
+  // If bufferOwner is not null, the returned Value keeps a reference to it so
+  // that the buffer stays alive for as long as the Value does.
+  static Value makeBorrowedString(Arena *arena, const char *data, size_t size,
+    const std::shared_ptr<const void>& bufferOwner);
+  // Creates a Value that is allocated from the arena, or from the heap if
+  // arena is null.
+  static Value makeArenaValue(Arena *arena, Type type);
+  static Value makeArenaValue(Arena *arena, bool input);
+  static Value makeArenaValue(Arena *arena, double input);
+  static Value makeArenaValue(Arena *arena, std::int64_t input);
+  // Sets a comment that refers to the chars in an input buffer instead of
+  // copying them. If bufferOwner is not null the Value keeps a reference to
+  // it so that the buffer stays alive for as long as the comment does.
+  static void setBorrowedComment(Value& val,
+    void (Value::*fp)(const std::string&), const char *data, size_t size,
+    const std::shared_ptr<const void>& bufferOwner);
+  // Moves the elements of "from" to the end of "to", which must both be of
+  // type Vector or both of type Map. A key that "to" already contains gets
+  // the value and comments from "from" in the same way as with
+  // assign_with_comments(), but keeps its place in the insertion order.
+  // Returns the number of such keys.
+  static size_t appendElements(Value& to, Value&& from);
+  // Same result as `map[key].assign_with_comments(std::move(elem))`, but
+  // without creating a MapProxy or copying the key more than once. The map
+  // must be of type Map.
+  static void setElement(Value& map, std::string&& key, Value&& elem);
+  // Adds a placeholder element for key to the end of the map, which must be
+  // of type Map, and moves key into it. Returns null and leaves key as it is
+  // if the map already contains key. The placeholder must be given its value
+  // by fillElement() or be removed by eraseLastElement() before the map is
+  // used for anything else.
+  static Value::ValueMap::value_type *insertElement(Value& map,
+    std::string& key);
+  // Gives the placeholder from insertElement() the value, comments and
+  // position of elem.
+  static void fillElement(Value::ValueMap::value_type *placeholder,
+    Value&& elem);
+  // Removes the placeholder from insertElement().
+  static void eraseLastElement(Value& map);
+};
+
+
+}
+
+
+#endif
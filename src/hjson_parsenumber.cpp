@@ -1,4 +1,4 @@
-#include "hjson.h"
+#include "hjson_internal.h"
 #include <cmath>
 #if HJSON_USE_CHARCONV
 # include <charconv>
@@ -21,6 +21,26 @@ struct NumberParser {
 };
 
 
+bool parseDecimalDouble(const char *pCh, size_t nCh, double *pNumber,
+  bool *pDecided);
+bool parseDecimalInt64(const char *pCh, size_t nCh, std::int64_t *pNumber);
+
+
+#if !HJSON_USE_CHARCONV && !HJSON_USE_STRTOD
+static bool _parseFloatStream(double *pNumber, const char *pCh, size_t nCh) {
+  std::string str(pCh, nCh);
+  std::stringstream ss(str);
+
+  // Make sure we expect dot (not comma) as decimal point.
+  ss.imbue(std::locale::classic());
+
+  ss >> *pNumber;
+
+  return ss.eof() && !ss.fail() && !std::isinf(*pNumber) && !std::isnan(*pNumber);
+}
+#endif
+
+
 static bool _parseFloat(double *pNumber, const char *pCh, size_t nCh) {
 #if HJSON_USE_CHARCONV
   auto res = std::from_chars(pCh, pCh + nCh, *pNumber);
@@ -33,16 +53,20 @@ static bool _parseFloat(double *pNumber, const char *pCh, size_t nCh) {
   *pNumber = std::strtod(pCh, &endptr);
 
   return !errno && endptr - pCh == nCh && !std::isinf(*pNumber) && !std::isnan(*pNumber);
+#elif HJSON_USE_STRINGSTREAM
+  return _parseFloatStream(pNumber, pCh, nCh);
 #else
-  std::string str(pCh, nCh);
-  std::stringstream ss(str);
+  bool decided;
 
-  // Make sure we expect dot (not comma) as decimal point.
-  ss.imbue(std::locale::classic());
-
-  ss >> *pNumber;
+  if (!parseDecimalDouble(pCh, nCh, pNumber, &decided)) {
+    return false;
+  }
+  if (!decided) {
+    // Very rare, more than 19 digits are needed to decide the rounding.
+    return _parseFloatStream(pNumber, pCh, nCh);
+  }
 
-  return ss.eof() && !ss.fail() && !std::isinf(*pNumber) && !std::isnan(*pNumber);
+  return !std::isinf(*pNumber);
 #endif
 }
 
@@ -58,7 +82,7 @@ static bool _parseInt(std::int64_t *pNumber, const char *pCh, size_t nCh) {
   *pNumber = std::strtoll(pCh, &endptr, 0);
 
   return !errno && endptr - pCh == nCh;
-#else
+#elif HJSON_USE_STRINGSTREAM
   std::string str(pCh, nCh);
   std::stringstream ss(str);
 
@@ -68,6 +92,8 @@ static bool _parseInt(std::int64_t *pNumber, const char *pCh, size_t nCh) {
   ss >> *pNumber;
 
   return ss.eof() && !ss.fail();
+#else
+  return parseDecimalInt64(pCh, nCh, pNumber);
 #endif
 }
 
@@ -90,7 +116,10 @@ static bool _next(NumberParser *p) {
 
 
 // Parse a number value. The parameter "text" must be zero terminated.
-bool tryParseNumber(Value *pValue, const char *text, size_t textSize, bool stopAtNext) {
+// On success *pIsInt tells if the number was stored in *pInt or in *pDouble.
+bool tryParseNumber(const char *text, size_t textSize, bool stopAtNext,
+  bool *pIsInt, std::int64_t *pInt, double *pDouble)
+{
   NumberParser p = {
     (const unsigned char*) text,
     textSize,
@@ -158,25 +187,44 @@ bool tryParseNumber(Value *pValue, const char *text, size_t textSize, bool stopA
     return false;
   }
 
-  std::int64_t i;
-  if (_parseInt(&i, (char*) p.data, end - 1)) {
-    *pValue = Value(i);
+  if (_parseInt(pInt, (char*) p.data, end - 1)) {
+    *pIsInt = true;
+    return true;
+  } else if (_parseFloat(pDouble, (char*) p.data, end - 1)) {
+    *pIsInt = false;
     return true;
-  } else {
-    double d;
-    if (_parseFloat(&d, (char*) p.data, end - 1)) {
-      *pValue = Value(d);
-      return true;
-    }
   }
 
   return false;
 }
 
 
+// Parse a number value. The parameter "text" must be zero terminated.
+// The Value is allocated from the arena, or from the heap if arena is null.
+bool tryParseNumber(Value *pValue, const char *text, size_t textSize,
+  bool stopAtNext, Arena *arena)
+{
+  bool isInt;
+  std::int64_t i;
+  double d;
+
+  if (!tryParseNumber(text, textSize, stopAtNext, &isInt, &i, &d)) {
+    return false;
+  }
+
+  if (isInt) {
+    *pValue = ValueInternal::makeArenaValue(arena, i);
+  } else {
+    *pValue = ValueInternal::makeArenaValue(arena, d);
+  }
+
+  return true;
+}
+
+
 bool startsWithNumber(const char *text, size_t textSize) {
   Value number;
-  return tryParseNumber(&number, text, textSize, true);
+  return tryParseNumber(&number, text, textSize, true, nullptr);
 }
 
 
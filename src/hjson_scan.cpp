@@ -0,0 +1,323 @@
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(_M_X64) || (defined(__i386__) && \
+  defined(__SSE2__)) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+# define HJSON_SCAN_SSE2 1
+# include <emmintrin.h>
+# if defined(__GNUC__) || defined(__clang__)
+#  define HJSON_SCAN_AVX2 1
+#  define HJSON_TARGET_AVX2 __attribute__((target("avx2")))
+#  include <immintrin.h>
+# elif defined(_MSC_VER)
+#  define HJSON_SCAN_AVX2 1
+#  define HJSON_TARGET_AVX2
+#  include <immintrin.h>
+#  include <intrin.h>
+# endif
+#endif
+
+
+namespace Hjson {
+
+
+// The scan functions below are used by the decoder to skip long runs of
+// whitespace, comment bodies and string chars. All of them take the index of
+// the first byte to examine and return the index of the first byte that stops
+// the scan, or dataSize if no such byte was found. A zero byte always stops
+// the scan, because the decoder treats it as end of input.
+
+
+struct ScanKernels {
+  size_t (*findNotWhite)(const unsigned char*, size_t, size_t);
+  size_t (*findCharOrZero)(const unsigned char*, size_t, size_t, unsigned char);
+  size_t (*findStringEnd)(const unsigned char*, size_t, size_t, unsigned char);
+};
+
+
+static inline bool _isWhite(unsigned char c) {
+  return c > 0 && c <= ' ';
+}
+
+
+static size_t _findNotWhiteScalar(const unsigned char *data, size_t pos,
+  size_t dataSize)
+{
+  while (pos < dataSize && _isWhite(data[pos])) {
+    ++pos;
+  }
+
+  return pos;
+}
+
+
+static size_t _findCharOrZeroScalar(const unsigned char *data, size_t pos,
+  size_t dataSize, unsigned char c)
+{
+  while (pos < dataSize && data[pos] != c && data[pos] != 0) {
+    ++pos;
+  }
+
+  return pos;
+}
+
+
+static inline bool _isStringEnd(unsigned char c, unsigned char quote) {
+  return c == quote || c == '\\' || c == '\n' || c == '\r' || c == 0;
+}
+
+
+static size_t _findStringEndScalar(const unsigned char *data, size_t pos,
+  size_t dataSize, unsigned char quote)
+{
+  while (pos < dataSize && !_isStringEnd(data[pos], quote)) {
+    ++pos;
+  }
+
+  return pos;
+}
+
+
+#if HJSON_SCAN_SSE2
+
+static inline unsigned _ctz(std::uint32_t mask) {
+#if defined(_MSC_VER) && !defined(__clang__)
+  unsigned long index;
+  _BitScanForward(&index, mask);
+  return static_cast<unsigned>(index);
+#else
+  return static_cast<unsigned>(__builtin_ctz(mask));
+#endif
+}
+
+
+static size_t _findNotWhiteSse2(const unsigned char *data, size_t pos,
+  size_t dataSize)
+{
+  const __m128i one = _mm_set1_epi8(1);
+  const __m128i maxWhite = _mm_set1_epi8(' ' - 1);
+
+  for (; pos + 16 <= dataSize; pos += 16) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + pos));
+    // (c - 1) <= 31 unsigned, i.e. 1 <= c <= 32.
+    __m128i t = _mm_sub_epi8(v, one);
+    __m128i white = _mm_cmpeq_epi8(_mm_min_epu8(t, maxWhite), t);
+    std::uint32_t mask = static_cast<std::uint32_t>(
+      _mm_movemask_epi8(white)) ^ 0xffff;
+    if (mask) {
+      return pos + _ctz(mask);
+    }
+  }
+
+  return _findNotWhiteScalar(data, pos, dataSize);
+}
+
+
+static size_t _findCharOrZeroSse2(const unsigned char *data, size_t pos,
+  size_t dataSize, unsigned char c)
+{
+  const __m128i needle = _mm_set1_epi8(static_cast<char>(c));
+  const __m128i zero = _mm_setzero_si128();
+
+  for (; pos + 16 <= dataSize; pos += 16) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + pos));
+    __m128i hit = _mm_or_si128(_mm_cmpeq_epi8(v, needle),
+      _mm_cmpeq_epi8(v, zero));
+    std::uint32_t mask = static_cast<std::uint32_t>(_mm_movemask_epi8(hit));
+    if (mask) {
+      return pos + _ctz(mask);
+    }
+  }
+
+  return _findCharOrZeroScalar(data, pos, dataSize, c);
+}
+
+
+static size_t _findStringEndSse2(const unsigned char *data, size_t pos,
+  size_t dataSize, unsigned char quote)
+{
+  const __m128i needle = _mm_set1_epi8(static_cast<char>(quote));
+  const __m128i backslash = _mm_set1_epi8('\\');
+  const __m128i lf = _mm_set1_epi8('\n');
+  const __m128i cr = _mm_set1_epi8('\r');
+  const __m128i zero = _mm_setzero_si128();
+
+  for (; pos + 16 <= dataSize; pos += 16) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + pos));
+    __m128i hit = _mm_or_si128(
+      _mm_or_si128(_mm_cmpeq_epi8(v, needle), _mm_cmpeq_epi8(v, backslash)),
+      _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, lf), _mm_cmpeq_epi8(v, cr)),
+        _mm_cmpeq_epi8(v, zero)));
+    std::uint32_t mask = static_cast<std::uint32_t>(_mm_movemask_epi8(hit));
+    if (mask) {
+      return pos + _ctz(mask);
+    }
+  }
+
+  return _findStringEndScalar(data, pos, dataSize, quote);
+}
+
+#endif // HJSON_SCAN_SSE2
+
+
+#if HJSON_SCAN_AVX2
+
+HJSON_TARGET_AVX2
+static size_t _findNotWhiteAvx2(const unsigned char *data, size_t pos,
+  size_t dataSize)
+{
+  const __m256i one = _mm256_set1_epi8(1);
+  const __m256i maxWhite = _mm256_set1_epi8(' ' - 1);
+
+  for (; pos + 32 <= dataSize; pos += 32) {
+    __m256i v = _mm256_loadu_si256(
+      reinterpret_cast<const __m256i*>(data + pos));
+    __m256i t = _mm256_sub_epi8(v, one);
+    __m256i white = _mm256_cmpeq_epi8(_mm256_min_epu8(t, maxWhite), t);
+    std::uint32_t mask = ~static_cast<std::uint32_t>(
+      _mm256_movemask_epi8(white));
+    if (mask) {
+      return pos + _ctz(mask);
+    }
+  }
+
+  return _findNotWhiteSse2(data, pos, dataSize);
+}
+
+
+HJSON_TARGET_AVX2
+static size_t _findCharOrZeroAvx2(const unsigned char *data, size_t pos,
+  size_t dataSize, unsigned char c)
+{
+  const __m256i needle = _mm256_set1_epi8(static_cast<char>(c));
+  const __m256i zero = _mm256_setzero_si256();
+
+  for (; pos + 32 <= dataSize; pos += 32) {
+    __m256i v = _mm256_loadu_si256(
+      reinterpret_cast<const __m256i*>(data + pos));
+    __m256i hit = _mm256_or_si256(_mm256_cmpeq_epi8(v, needle),
+      _mm256_cmpeq_epi8(v, zero));
+    std::uint32_t mask = static_cast<std::uint32_t>(_mm256_movemask_epi8(hit));
+    if (mask) {
+      return pos + _ctz(mask);
+    }
+  }
+
+  return _findCharOrZeroSse2(data, pos, dataSize, c);
+}
+
+
+HJSON_TARGET_AVX2
+static size_t _findStringEndAvx2(const unsigned char *data, size_t pos,
+  size_t dataSize, unsigned char quote)
+{
+  const __m256i needle = _mm256_set1_epi8(static_cast<char>(quote));
+  const __m256i backslash = _mm256_set1_epi8('\\');
+  const __m256i lf = _mm256_set1_epi8('\n');
+  const __m256i cr = _mm256_set1_epi8('\r');
+  const __m256i zero = _mm256_setzero_si256();
+
+  for (; pos + 32 <= dataSize; pos += 32) {
+    __m256i v = _mm256_loadu_si256(
+      reinterpret_cast<const __m256i*>(data + pos));
+    __m256i hit = _mm256_or_si256(
+      _mm256_or_si256(_mm256_cmpeq_epi8(v, needle),
+        _mm256_cmpeq_epi8(v, backslash)),
+      _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, lf),
+        _mm256_cmpeq_epi8(v, cr)), _mm256_cmpeq_epi8(v, zero)));
+    std::uint32_t mask = static_cast<std::uint32_t>(_mm256_movemask_epi8(hit));
+    if (mask) {
+      return pos + _ctz(mask);
+    }
+  }
+
+  return _findStringEndSse2(data, pos, dataSize, quote);
+}
+
+
+static bool _hasAvx2() {
+#if defined(_MSC_VER) && !defined(__clang__)
+  int info[4];
+  __cpuid(info, 0);
+  if (info[0] < 7) {
+    return false;
+  }
+  __cpuid(info, 1);
+  // OSXSAVE and AVX, then check that the OS saves the YMM registers.
+  if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0 ||
+    (_xgetbv(0) & 6) != 6)
+  {
+    return false;
+  }
+  __cpuidex(info, 7, 0);
+  return (info[1] & (1 << 5)) != 0;
+#else
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif // HJSON_SCAN_AVX2
+
+
+static ScanKernels _selectKernels() {
+#if HJSON_SCAN_AVX2
+  if (_hasAvx2()) {
+    return { _findNotWhiteAvx2, _findCharOrZeroAvx2, _findStringEndAvx2 };
+  }
+#endif
+#if HJSON_SCAN_SSE2
+  return { _findNotWhiteSse2, _findCharOrZeroSse2, _findStringEndSse2 };
+#else
+  return { _findNotWhiteScalar, _findCharOrZeroScalar,
+    _findStringEndScalar };
+#endif
+}
+
+
+static const ScanKernels& _kernels() {
+  static const ScanKernels kernels = _selectKernels();
+  return kernels;
+}
+
+
+// Returns the index of the first byte that is not whitespace (0x01 - 0x20).
+size_t scanWhite(const unsigned char *data, size_t pos, size_t dataSize) {
+  return _kernels().findNotWhite(data, pos, dataSize);
+}
+
+
+// Returns the index of the first line feed.
+size_t scanLineEnd(const unsigned char *data, size_t pos, size_t dataSize) {
+  return _kernels().findCharOrZero(data, pos, dataSize, '\n');
+}
+
+
+// Returns the index of the '*' in the first "*/".
+size_t scanBlockCommentEnd(const unsigned char *data, size_t pos,
+  size_t dataSize)
+{
+  auto findCharOrZero = _kernels().findCharOrZero;
+
+  for (;;) {
+    pos = findCharOrZero(data, pos, dataSize, '*');
+    if (pos >= dataSize || data[pos] == 0 ||
+      (pos + 1 < dataSize && data[pos + 1] == '/'))
+    {
+      return pos;
+    }
+    ++pos;
+  }
+}
+
+
+// Returns the index of the first quote char, backslash, CR or LF, i.e. the
+// first byte in a quoted string that cannot be copied as it is.
+size_t scanStringEnd(const unsigned char *data, size_t pos, size_t dataSize,
+  unsigned char quote)
+{
+  return _kernels().findStringEnd(data, pos, dataSize, quote);
+}
+
+
+}
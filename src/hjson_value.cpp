@@ -1,8 +1,9 @@
-#include "hjson.h"
+#include "hjson_internal.h"
 #include <vector>
 #include <assert.h>
 #include <cstring>
 #include <algorithm>
+#include <atomic>
 #if HJSON_USE_CHARCONV
 # include <charconv>
 # include <array>
@@ -24,89 +25,716 @@ std::string version()
   return TO_STR(HJSON_VERSION);
 }
 
-typedef std::vector<std::string> KeyVec;
 typedef std::vector<Value> ValueVec;
-typedef std::map<std::string, Value> ValueMap;
 
 
+// The elements of a Map in insertion order, and a hash table of indexes into
+// elems for lookups by key. Maps with few elements are searched linearly and
+// have no hash table. Each element is allocated separately, so that references
+// to it stay valid when other elements are added or removed.
 class ValueVecMap {
 public:
-  KeyVec v;
-  ValueMap m;
+  typedef Value::ValueMap::value_type Elem;
+
+  ValueVecMap() = default;
+  ValueVecMap(const ValueVecMap&) = delete;
+  ValueVecMap& operator=(const ValueVecMap&) = delete;
+  ~ValueVecMap() { clear(); }
+
+  // Owned by this object.
+  std::vector<Elem*> elems;
+
+  // Returns null if key is not found.
+  Elem *find(const char *key, size_t keySize);
+  Elem *find(const std::string& key) {
+    return find(key.data(), key.size());
+  }
+  // The key must not already be in the map.
+  Elem *insert(std::string&& key, Value&& val) {
+    return insert(new Elem(std::move(key), std::move(val)));
+  }
+  // Takes ownership of elem, whose key must not already be in the map.
+  Elem *insert(Elem *elem);
+  void erase(size_t index);
+  // Returns false if key is not found.
+  bool erase(const std::string& key);
+  void move(size_t from, size_t to);
+  void clear();
+  // Like clear(), but hands over the ownership of the elements to the caller.
+  void release();
+
+  Value::ValueMap::iterator begin() {
+    return Value::ValueMap::iterator(elems.data());
+  }
+  Value::ValueMap::iterator end() {
+    return Value::ValueMap::iterator(elems.data() + elems.size());
+  }
+
+private:
+  struct Slot {
+    std::uint32_t hash;
+    // Index in elems + 1, or 0 if the slot is empty.
+    std::uint32_t elem;
+  };
+
+  static const size_t linearLimit = 8;
+
+  static std::uint32_t _hash(const char *key, size_t keySize);
+  // Returns the index in elems of key, or elems.size() if key is not found.
+  size_t _find(const char *key, size_t keySize) const;
+  void _place(std::uint32_t hash, std::uint32_t elem);
+  void _unplace(std::uint32_t elem);
+  void _rehash();
+
+  // Empty as long as elems.size() <= linearLimit, otherwise the size is a
+  // power of two and at most 3/4 of the slots are used.
+  std::vector<Slot> table;
+};
+
+
+std::uint32_t ValueVecMap::_hash(const char *key, size_t keySize) {
+  // FNV-1a
+  std::uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < keySize; ++i) {
+    hash = (hash ^ static_cast<unsigned char>(key[i])) * 16777619u;
+  }
+
+  return hash;
+}
+
+
+void ValueVecMap::_place(std::uint32_t hash, std::uint32_t elem) {
+  size_t mask = table.size() - 1;
+  size_t pos = hash & mask;
+
+  while (table[pos].elem) {
+    pos = (pos + 1) & mask;
+  }
+
+  table[pos].hash = hash;
+  table[pos].elem = elem;
+}
+
+
+// Removes elem from the table and moves up the slots that follow it, so that
+// they can still be found.
+void ValueVecMap::_unplace(std::uint32_t elem) {
+  size_t mask = table.size() - 1;
+  auto& key = elems[elem - 1]->first;
+  size_t pos = _hash(key.data(), key.size()) & mask;
+
+  while (table[pos].elem != elem) {
+    pos = (pos + 1) & mask;
+  }
+  table[pos].elem = 0;
+
+  for (pos = (pos + 1) & mask; table[pos].elem; pos = (pos + 1) & mask) {
+    auto slot = table[pos];
+    table[pos].elem = 0;
+    _place(slot.hash, slot.elem);
+  }
+}
+
+
+void ValueVecMap::_rehash() {
+  table.clear();
+  if (elems.size() <= linearLimit) {
+    return;
+  }
+
+  size_t size = 16;
+  while (size < elems.size() * 2) {
+    size *= 2;
+  }
+
+  table.resize(size, Slot{0, 0});
+  for (size_t i = 0; i < elems.size(); ++i) {
+    _place(_hash(elems[i]->first.data(), elems[i]->first.size()),
+      static_cast<std::uint32_t>(i + 1));
+  }
+}
+
+
+size_t ValueVecMap::_find(const char *key, size_t keySize) const {
+  if (table.empty()) {
+    for (size_t i = 0; i < elems.size(); ++i) {
+      auto& k = elems[i]->first;
+      if (k.size() == keySize && !std::memcmp(k.data(), key, keySize)) {
+        return i;
+      }
+    }
+
+    return elems.size();
+  }
+
+  std::uint32_t hash = _hash(key, keySize);
+  size_t mask = table.size() - 1;
+
+  for (size_t pos = hash & mask; table[pos].elem; pos = (pos + 1) & mask) {
+    if (table[pos].hash == hash) {
+      size_t i = table[pos].elem - 1;
+      auto& k = elems[i]->first;
+      if (k.size() == keySize && !std::memcmp(k.data(), key, keySize)) {
+        return i;
+      }
+    }
+  }
+
+  return elems.size();
+}
+
+
+ValueVecMap::Elem *ValueVecMap::find(const char *key, size_t keySize) {
+  size_t i = _find(key, keySize);
+
+  return i < elems.size() ? elems[i] : nullptr;
+}
+
+
+ValueVecMap::Elem *ValueVecMap::insert(Elem *elem) {
+  elems.push_back(elem);
+
+  if (elems.size() > linearLimit) {
+    if (table.empty() || elems.size() * 4 > table.size() * 3) {
+      _rehash();
+    } else {
+      auto& k = elem->first;
+      _place(_hash(k.data(), k.size()),
+        static_cast<std::uint32_t>(elems.size()));
+    }
+  }
+
+  return elem;
+}
+
+
+void ValueVecMap::erase(size_t index) {
+  auto elem = elems[index];
+
+  if (!table.empty()) {
+    _unplace(static_cast<std::uint32_t>(index + 1));
+  }
+  elems.erase(elems.begin() + index);
+
+  if (elems.size() <= linearLimit) {
+    table.clear();
+  } else if (elems.size() * 8 < table.size()) {
+    // Shrinks the table, which is then scanned faster by the next erase.
+    _rehash();
+  } else if (index < elems.size()) {
+    // The elements after the erased one have moved down one step. No key
+    // needs to be hashed again.
+    auto erased = static_cast<std::uint32_t>(index + 1);
+    for (auto& slot : table) {
+      slot.elem -= (slot.elem > erased);
+    }
+  }
+
+  delete elem;
+}
+
+
+bool ValueVecMap::erase(const std::string& key) {
+  size_t i = _find(key.data(), key.size());
+  if (i == elems.size()) {
+    return false;
+  }
+
+  erase(i);
+
+  return true;
+}
+
+
+// The element at index from ends up at index to - 1 if from < to, otherwise
+// at index to.
+void ValueVecMap::move(size_t from, size_t to) {
+  auto it = elems.begin();
+
+  if (from < to) {
+    std::rotate(it + from, it + from + 1, it + to);
+    --to;
+  } else if (to < from) {
+    std::rotate(it + to, it + from, it + from + 1);
+  } else {
+    return;
+  }
+
+  // Only the indexes between from and to have changed, no key needs to be
+  // hashed again.
+  auto f = static_cast<std::uint32_t>(from + 1);
+  auto t = static_cast<std::uint32_t>(to + 1);
+  if (from < to) {
+    for (auto& slot : table) {
+      auto e = slot.elem;
+      slot.elem = (e == f ? t : e - (e > f && e <= t));
+    }
+  } else {
+    for (auto& slot : table) {
+      auto e = slot.elem;
+      slot.elem = (e == f ? t : e + (e >= t && e < f));
+    }
+  }
+}
+
+
+void ValueVecMap::clear() {
+  // Emptied before the elements are destroyed, in case an element refers
+  // back to this map.
+  std::vector<Elem*> old;
+  old.swap(elems);
+  table.clear();
+  for (auto elem : old) {
+    delete elem;
+  }
+}
+
+
+void ValueVecMap::release() {
+  elems.clear();
+  table.clear();
+}
+
+
+// Character data owned by someone else, see DecoderOptions::borrowInputBuffer.
+struct StringRef {
+  const char *data;
+  size_t size;
+};
+
+
+// Reference counter for ValueImpl and Comments objects. Not atomic if the lib
+// is built with the Cmake option HJSON_ATOMIC_REFCOUNT set to OFF, for
+// applications where each Value tree is only used by one thread at a time.
+class RefCount {
+public:
+  explicit RefCount(int count) : m_count(count) {}
+
+#if HJSON_NONATOMIC_REFCOUNT
+  void increment() { ++m_count; }
+  // Returns true if the count became zero.
+  bool decrement() { return --m_count == 0; }
+  bool unique() const { return m_count == 1; }
+
+private:
+  int m_count;
+#else
+  void increment() { m_count.fetch_add(1, std::memory_order_relaxed); }
+  // Returns true if the count became zero.
+  bool decrement() {
+    return m_count.fetch_sub(1, std::memory_order_acq_rel) == 1;
+  }
+  bool unique() const { return m_count.load(std::memory_order_acquire) == 1; }
+
+private:
+  std::atomic<int> m_count;
+#endif
 };
 
 
+// Holds the Value types that are not stored in Value::Storage. Shared by all
+// copies of a Value, and by MapProxy objects referring to its elements.
 class Value::ValueImpl {
 public:
+  RefCount refs;
   Type type;
+  // True if this is a Borrowed, a String that uses "r" instead of "s".
+  bool borrowed = false;
+  // True if this object was allocated from an Arena.
+  bool inArena = false;
+  // True if this is an Owning (see makeBorrowedString()).
+  bool owning = false;
+  // True if this is a Borrowed, even if its string has been copied since.
+  bool borrowing = false;
   union {
-    bool b;
     double d;
     std::int64_t i;
     std::string *s;
+    StringRef r;
     ValueVec *v;
     ValueVecMap *m;
   };
 
-  ValueImpl();
-  ValueImpl(bool);
-  ValueImpl(double);
+  // Creates a String that owns a copy of the data.
+  ValueImpl(const char *data, size_t size);
+  // Creates a String that refers to the data instead of copying it. Only used
+  // by Borrowed.
+  ValueImpl(const StringRef&);
+  explicit ValueImpl(double);
   explicit ValueImpl(std::int64_t);
-  ValueImpl(const std::string&);
+  // Only Undefined, Double, Int64, String, Vector and Map.
   ValueImpl(Type);
   ~ValueImpl();
   static void DeepClear(Value &val);
+
+  static ValueImpl *retain(ValueImpl *impl) {
+    impl->refs.increment();
+    return impl;
+  }
+  static void release(ValueImpl*);
+  // Allocates the object from the arena, or from the heap if arena is null.
+  template<typename T, typename... Args>
+  static ValueImpl *allocate(Arena *arena, Args&&... args) {
+    if (arena) {
+      auto impl = new(arena->allocate(sizeof(T), alignof(T)))
+        T(std::forward<Args>(args)...);
+      impl->inArena = true;
+      return impl;
+    }
+
+    return new T(std::forward<Args>(args)...);
+  }
+  // Destroys an object from allocate(). The memory of an object allocated
+  // from an Arena is released together with the Arena.
+  template<typename T>
+  static void destroy(T *impl) {
+    if (impl->inArena) {
+      impl->~T();
+    } else {
+      delete impl;
+    }
+  }
+  // Copies the storage, sharing the ValueImpl if there is one.
+  static void assign(Storage& to, const Storage& from) {
+    if (!from.type) {
+      retain(from.impl);
+    }
+    if (!to.type) {
+      release(to.impl);
+    }
+    to = from;
+  }
+  // Turns an Undefined into an empty Vector or Map, visible to all Values
+  // that share this object.
+  void convert(Type);
+
+  // Stores a copy of the string in val, which must not hold a reference to
+  // a ValueImpl.
+  static void set_str(Value& val, const char *data, size_t size) {
+    val.u.impl = new ValueImpl(data, size);
+    val.u.type = 0;
+  }
+
+  // Accessors for the character data of a String, regardless of ownership.
+  static const char *str_data(const Value& val) {
+    auto impl = val.u.impl;
+    return impl->borrowed ? impl->r.data : impl->s->data();
+  }
+  static size_t str_size(const Value& val) {
+    auto impl = val.u.impl;
+    return impl->borrowed ? impl->r.size : impl->s->size();
+  }
+  static std::string str(const Value& val) {
+    return std::string(str_data(val), str_size(val));
+  }
+  static int str_compare(const Value&, const Value&);
+  // Returns a zero-terminated version of the String. A borrowed string is not
+  // zero-terminated, so it is copied.
+  static const char *c_str(const Value&);
+  static void str_append(Value&, const char *data, size_t size);
+
+  class Borrowed;
+  class Owning;
 };
 
 
+// A comment is either a copy owned by this object, or refers to chars in an
+// input buffer that is kept alive by m_bufferOwner (see setBorrowedComment()).
+// A referenced comment is only copied to a std::string when it is read.
+// Copies of a Value share the same Comments object, which is copied when one
+// of them changes its comments (see unshare()).
 class Value::Comments {
 public:
-  std::string m_commentBefore, m_commentKey, m_commentInside, m_commentAfter;
+  enum Slot { Before, Key, Inside, After, SlotCount };
+
+  Comments();
+  Comments(const Comments&);
+  ~Comments();
+  Comments& operator=(const Comments&) = delete;
+
+  std::string get(Slot slot) const {
+    return std::string(m_text[slot].data, m_text[slot].size);
+  }
+  void set(Slot, const char *data, size_t size);
+  void set_ref(Slot, const char *data, size_t size,
+    const std::shared_ptr<const void>& bufferOwner);
+  // Copies all referenced comments and releases the buffer owner.
+  void own();
+  // True if any comment refers to an input buffer.
+  bool borrowed() const;
+  // True if no other Value shares this object.
+  bool unique() const { return m_refs.unique(); }
+
+  // Deleted when the last Value sharing the object releases it.
+  static Comments *retain(Comments *cm) {
+    if (cm) {
+      cm->m_refs.increment();
+    }
+    return cm;
+  }
+  static void release(Comments *cm) {
+    if (cm && cm->m_refs.decrement()) {
+      delete cm;
+    }
+  }
+  static void assign(Comments*& to, Comments *from) {
+    retain(from);
+    release(to);
+    to = from;
+  }
+  // Makes sure that cm is not shared with any other Value, so that it can be
+  // changed. Creates a new object if cm is null.
+  static Comments *unshare(Comments*& cm) {
+    if (!cm) {
+      cm = new Comments();
+    } else if (!cm->unique()) {
+      auto copy = new Comments(*cm);
+      release(cm);
+      cm = copy;
+    }
+    return cm;
+  }
+
+private:
+  struct Text {
+    const char *data;
+    size_t size;
+  };
+
+  void _release(Slot);
+
+  Text m_text[SlotCount];
+  // Bit n is set if m_text[n].data was allocated by this object.
+  unsigned char m_owned;
+  RefCount m_refs;
+  std::shared_ptr<const void> m_bufferOwner;
 };
 
 
-Value::ValueImpl::ValueImpl()
-  : type(Type::Undefined)
+Value::Comments::Comments()
+  : m_owned(0),
+  m_refs(1)
 {
+  for (auto& text : m_text) {
+    text.data = "";
+    text.size = 0;
+  }
 }
 
 
-Value::ValueImpl::ValueImpl(bool input)
-  : type(Type::Bool),
-  b(input)
+Value::Comments::Comments(const Comments& other)
+  : Comments()
 {
+  m_bufferOwner = other.m_bufferOwner;
+
+  for (int slot = 0; slot < SlotCount; ++slot) {
+    if (other.m_owned & (1 << slot)) {
+      set(static_cast<Slot>(slot), other.m_text[slot].data,
+        other.m_text[slot].size);
+    } else {
+      m_text[slot] = other.m_text[slot];
+    }
+  }
 }
 
 
-Value::ValueImpl::ValueImpl(double input)
-  : type(Type::Double),
-  d(input)
+Value::Comments::~Comments() {
+  for (int slot = 0; slot < SlotCount; ++slot) {
+    _release(static_cast<Slot>(slot));
+  }
+}
+
+
+void Value::Comments::_release(Slot slot) {
+  if (m_owned & (1 << slot)) {
+    delete[] m_text[slot].data;
+    m_owned &= ~(1 << slot);
+  }
+
+  m_text[slot].data = "";
+  m_text[slot].size = 0;
+}
+
+
+void Value::Comments::set(Slot slot, const char *data, size_t size) {
+  char *copy = nullptr;
+  if (size) {
+    copy = new char[size];
+    std::memcpy(copy, data, size);
+  }
+
+  _release(slot);
+
+  if (copy) {
+    m_text[slot].data = copy;
+    m_text[slot].size = size;
+    m_owned |= 1 << slot;
+  }
+}
+
+
+void Value::Comments::own() {
+  for (int slot = 0; slot < SlotCount; ++slot) {
+    if (!(m_owned & (1 << slot)) && m_text[slot].size) {
+      set(static_cast<Slot>(slot), m_text[slot].data, m_text[slot].size);
+    }
+  }
+
+  m_bufferOwner.reset();
+}
+
+
+bool Value::Comments::borrowed() const {
+  for (int slot = 0; slot < SlotCount; ++slot) {
+    if (!(m_owned & (1 << slot)) && m_text[slot].size) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+
+void Value::Comments::set_ref(Slot slot, const char *data, size_t size,
+  const std::shared_ptr<const void>& bufferOwner)
 {
+  if (bufferOwner != m_bufferOwner) {
+    // Only one buffer can be kept alive, copy any comments referring to the
+    // previous one.
+    _release(slot);
+    own();
+    m_bufferOwner = bufferOwner;
+  }
+
+  _release(slot);
+  m_text[slot].data = data;
+  m_text[slot].size = size;
 }
 
 
-Value::ValueImpl::ValueImpl(std::int64_t input)
-  : type(Type::Int64),
-  i(input)
+void ValueInternal::setBorrowedComment(Value& val,
+  void (Value::*fp)(const std::string&), const char *data, size_t size,
+  const std::shared_ptr<const void>& bufferOwner)
 {
+  Value::Comments::Slot slot;
+  if (fp == &Value::set_comment_before) {
+    slot = Value::Comments::Before;
+  } else if (fp == &Value::set_comment_key) {
+    slot = Value::Comments::Key;
+  } else if (fp == &Value::set_comment_inside) {
+    slot = Value::Comments::Inside;
+  } else {
+    slot = Value::Comments::After;
+  }
+
+  if (!val.cm && !size) {
+    return;
+  }
+
+  Value::Comments::unshare(val.cm)->set_ref(slot, data, size, bufferOwner);
 }
 
 
-Value::ValueImpl::ValueImpl(const std::string &input)
-  : type(Type::String),
-  s(new std::string(input))
+// A String that refers to chars in an input buffer. The chars are never
+// changed, but c_str() adds a zero-terminated copy of them. Several threads
+// may call c_str() on Values sharing the same object, so the copy is only
+// set once, atomically.
+class Value::ValueImpl::Borrowed : public Value::ValueImpl {
+public:
+  explicit Borrowed(const StringRef& ref)
+    : ValueImpl(ref),
+    copy(nullptr)
+  {
+    borrowing = true;
+  }
+  ~Borrowed() {
+    delete copy.load(std::memory_order_relaxed);
+  }
+
+  const char *c_str();
+
+private:
+  std::atomic<std::string*> copy;
+};
+
+
+class Value::ValueImpl::Owning : public Value::ValueImpl::Borrowed {
+public:
+  Owning(const StringRef& ref, const std::shared_ptr<const void>& _bufferOwner)
+    : Borrowed(ref),
+    bufferOwner(_bufferOwner)
+  {
+    owning = true;
+  }
+
+  std::shared_ptr<const void> bufferOwner;
+};
+
+
+Value::ValueImpl::ValueImpl(const char *data, size_t size)
+  : refs(1),
+  type(Type::String),
+  s(new std::string(data, size))
+{
+}
+
+
+Value::ValueImpl::ValueImpl(const StringRef& ref)
+  : refs(1),
+  type(Type::String),
+  borrowed(true),
+  r(ref)
+{
+}
+
+
+Value::ValueImpl::ValueImpl(double input)
+  : refs(1),
+  type(Type::Double),
+  d(input)
+{
+}
+
+
+Value::ValueImpl::ValueImpl(std::int64_t input)
+  : refs(1),
+  type(Type::Int64),
+  i(input)
 {
 }
 
 
 Value::ValueImpl::ValueImpl(Type _type)
-  : type(_type)
+  : refs(1),
+  type(Type::Undefined)
 {
   switch (_type)
   {
+  case Type::Double:
+    type = Type::Double;
+    d = 0;
+    break;
+  case Type::Int64:
+    type = Type::Int64;
+    i = 0;
+    break;
   case Type::String:
+    type = Type::String;
     s = new std::string();
     break;
+  default:
+    convert(_type);
+    break;
+  }
+}
+
+
+void Value::ValueImpl::convert(Type _type) {
+  assert(type == Type::Undefined);
+
+  type = _type;
+  switch (_type)
+  {
   case Type::Vector:
     v = new ValueVec();
     break;
@@ -119,10 +747,25 @@ Value::ValueImpl::ValueImpl(Type _type)
 }
 
 
+void Value::ValueImpl::release(ValueImpl *impl) {
+  if (!impl->refs.decrement()) {
+    return;
+  }
+
+  if (impl->owning) {
+    destroy(static_cast<Owning*>(impl));
+  } else if (impl->borrowing) {
+    destroy(static_cast<Borrowed*>(impl));
+  } else {
+    destroy(impl);
+  }
+}
+
+
 // Bottom-up destruction in order to avoid stack overflow due to recursive destructor calls.
 void Value::ValueImpl::DeepClear(Value &val) {
-  // The map/vector will only be destroyed if use_count == 1
-  if (val.size() && val.prv.use_count() == 1) {
+  // The map/vector will only be destroyed if it is not shared
+  if (val.size() && val.u.impl->refs.unique()) {
     std::vector<std::pair<Value, int> > v;
 
     v.emplace_back(val, 0);
@@ -134,8 +777,8 @@ void Value::ValueImpl::DeepClear(Value &val) {
       } else {
         Value &n = v.back().first[v.back().second];
         v.back().second++;
-        // The map/vector will only be destroyed if use_count == 1
-        if (n.size() && n.prv.use_count() == 1) {
+        // The map/vector will only be destroyed if it is not shared
+        if (n.size() && n.u.impl->refs.unique()) {
           v.emplace_back(v.back().first[v.back().second - 1], 0);
         }
       }
@@ -148,7 +791,9 @@ Value::ValueImpl::~ValueImpl() {
   switch (type)
   {
   case Type::String:
-    delete s;
+    if (!borrowed) {
+      delete s;
+    }
     break;
   case Type::Vector:
     for (auto e = v->begin(); e != v->end(); ++e) {
@@ -157,8 +802,8 @@ Value::ValueImpl::~ValueImpl() {
     delete v;
     break;
   case Type::Map:
-    for (auto e = m->m.begin(); e != m->m.end(); ++e) {
-      DeepClear(e->second);
+    for (auto e = m->elems.begin(); e != m->elems.end(); ++e) {
+      DeepClear((*e)->second);
     }
     delete m;
     break;
@@ -168,136 +813,337 @@ Value::ValueImpl::~ValueImpl() {
 }
 
 
+int Value::ValueImpl::str_compare(const Value& a, const Value& b) {
+  size_t sizeA = str_size(a), sizeB = str_size(b);
+  const char *dataA = str_data(a), *dataB = str_data(b);
+  if (dataA == dataB && sizeA == sizeB) {
+    // Interned strings (see DecoderOptions::internTable) are compared by
+    // pointer.
+    return 0;
+  }
+
+  int ret = std::memcmp(dataA, dataB, std::min(sizeA, sizeB));
+
+  if (ret == 0 && sizeA != sizeB) {
+    ret = (sizeA < sizeB ? -1 : 1);
+  }
+
+  return ret;
+}
+
+
+const char *Value::ValueImpl::c_str(const Value& val) {
+  auto impl = val.u.impl;
+  if (impl->borrowed) {
+    return static_cast<Borrowed*>(impl)->c_str();
+  }
+
+  return impl->s->c_str();
+}
+
+
+const char *Value::ValueImpl::Borrowed::c_str() {
+  auto ret = copy.load(std::memory_order_acquire);
+  if (!ret) {
+    // If another thread sets the copy first, that copy is used instead.
+    auto fresh = new std::string(r.data, r.size);
+    if (copy.compare_exchange_strong(ret, fresh, std::memory_order_acq_rel,
+      std::memory_order_acquire))
+    {
+      ret = fresh;
+    } else {
+      delete fresh;
+    }
+  }
+
+  return ret->c_str();
+}
+
+
+void Value::ValueImpl::str_append(Value& val, const char *data, size_t size) {
+  auto impl = val.u.impl;
+  if (impl->borrowed) {
+    // The borrowed chars cannot be changed, so the string is copied. The copy
+    // is made in place, so that all Values sharing the string see the change.
+    impl->s = new std::string(impl->r.data, impl->r.size);
+    impl->borrowed = false;
+  }
+
+  impl->s->append(data, size);
+}
+
+
+Value ValueInternal::makeBorrowedString(Arena *arena, const char *data,
+  size_t size, const std::shared_ptr<const void>& bufferOwner)
+{
+  Value ret(Type::Null);
+
+  StringRef ref;
+  ref.data = data;
+  ref.size = size;
+
+  if (bufferOwner) {
+    ret.u.impl = Value::ValueImpl::allocate<Value::ValueImpl::Owning>(arena,
+      ref, bufferOwner);
+  } else {
+    ret.u.impl = Value::ValueImpl::allocate<Value::ValueImpl::Borrowed>(arena,
+      ref);
+  }
+  ret.u.type = 0;
+
+  return ret;
+}
+
+
+Value ValueInternal::makeArenaValue(Arena *arena, Type type) {
+  switch (type)
+  {
+  case Type::Undefined:
+  case Type::String:
+  case Type::Vector:
+  case Type::Map:
+    return Value(Value::ValueImpl::allocate<Value::ValueImpl>(arena, type),
+      nullptr, Value::Position());
+  default:
+    return Value(type);
+  }
+}
+
+
+// Bool is stored in the Value itself, so it never uses the arena.
+Value ValueInternal::makeArenaValue(Arena*, bool input) {
+  return Value(input);
+}
+
+
+Value ValueInternal::makeArenaValue(Arena *arena, double input) {
+  return Value(Value::ValueImpl::allocate<Value::ValueImpl>(arena, input),
+    nullptr, Value::Position());
+}
+
+
+Value ValueInternal::makeArenaValue(Arena *arena, std::int64_t input) {
+  return Value(Value::ValueImpl::allocate<Value::ValueImpl>(arena, input),
+    nullptr, Value::Position());
+}
+
+
+// Used by the decoder to put together the parts of a container.
+size_t ValueInternal::appendElements(Value& to, Value&& from) {
+  size_t duplicates = 0;
+
+  if (to.type() == Type::Vector) {
+    to.u.impl->v->reserve(to.u.impl->v->size() + from.u.impl->v->size());
+    for (auto& elem : *from.u.impl->v) {
+      to.u.impl->v->push_back(std::move(elem));
+    }
+    from.u.impl->v->clear();
+  } else {
+    auto m = to.u.impl->m;
+    // The elements of "from" are handed over to "to" without being copied.
+    for (auto fromElem : from.u.impl->m->elems) {
+      auto elem = m->find(fromElem->first);
+      if (elem) {
+        elem->second.assign_with_comments(std::move(fromElem->second));
+        delete fromElem;
+        ++duplicates;
+      } else {
+        m->insert(fromElem);
+      }
+    }
+    from.u.impl->m->release();
+  }
+
+  return duplicates;
+}
+
+
+void ValueInternal::setElement(Value& map, std::string&& key, Value&& elem) {
+  auto found = map.u.impl->m->find(key);
+  if (found) {
+    found->second.assign_with_comments(std::move(elem));
+  } else {
+    map.u.impl->m->insert(std::move(key), std::move(elem));
+  }
+}
+
+
+// Used by the decoder to find duplicate keys with a single lookup.
+Value::ValueMap::value_type *ValueInternal::insertElement(Value& map,
+  std::string& key)
+{
+  auto m = map.u.impl->m;
+  if (m->find(key)) {
+    return nullptr;
+  }
+
+  // Null is stored in the Value itself, so the placeholder allocates nothing
+  // more than the element.
+  return m->insert(std::move(key), Value(Type::Null));
+}
+
+
+void ValueInternal::fillElement(Value::ValueMap::value_type *placeholder,
+  Value&& elem)
+{
+  // The placeholder has neither an impl nor comments, so they are simply
+  // taken from elem.
+  auto& target = placeholder->second;
+  target.u = elem.u;
+  target.cm = elem.cm;
+  target.position = elem.position;
+  elem.u.type = static_cast<unsigned char>(Type::Null);
+  elem.cm = nullptr;
+}
+
+
+void ValueInternal::eraseLastElement(Value& map) {
+  auto m = map.u.impl->m;
+  m->erase(m->elems.size() - 1);
+}
+
+
 // Sacrifice efficiency for predictability: It is allowed to do bracket
 // assignment on an Undefined Value, and thereby turn it into a Map Value.
 // A Map Value is passed by reference, therefore an Undefined Value should also
 // be passed by reference, to avoid surprises when doing bracket assignment
 // on a Value that has been passed around but is still of type Undefined.
-Value::Value()
-  : prv(std::make_shared<ValueImpl>(Type::Undefined))
-{
+Value::Value() {
+  u.impl = new ValueImpl(Type::Undefined);
+  u.type = 0;
 }
 
 
-Value::Value(bool input)
-  : prv(std::make_shared<ValueImpl>(input))
-{
+Value::Value(bool input) {
+  u.b = input;
+  u.type = static_cast<unsigned char>(Type::Bool);
 }
 
 
 Value::Value(float input)
-  : prv(std::make_shared<ValueImpl>(static_cast<double>(input)))
+  : Value(static_cast<double>(input))
 {
 }
 
 
-Value::Value(double input)
-  : prv(std::make_shared<ValueImpl>(input))
-{
+Value::Value(double input) {
+  u.impl = new ValueImpl(input);
+  u.type = 0;
 }
 
 
 Value::Value(long double input)
-  : prv(std::make_shared<ValueImpl>(static_cast<double>(input)))
+  : Value(static_cast<double>(input))
 {
 }
 
 
 Value::Value(char input)
-  : prv(std::make_shared<ValueImpl>(static_cast<std::int64_t>(input)))
+  : Value(static_cast<long long>(input))
 {
 }
 
 
 Value::Value(unsigned char input)
-  : prv(std::make_shared<ValueImpl>(static_cast<std::int64_t>(input)))
+  : Value(static_cast<long long>(input))
 {
 }
 
 
 Value::Value(short input)
-  : prv(std::make_shared<ValueImpl>(static_cast<std::int64_t>(input)))
+  : Value(static_cast<long long>(input))
 {
 }
 
 
 Value::Value(unsigned short input)
-  : prv(std::make_shared<ValueImpl>(static_cast<std::int64_t>(input)))
+  : Value(static_cast<long long>(input))
 {
 }
 
 
 Value::Value(int input)
-  : prv(std::make_shared<ValueImpl>(static_cast<std::int64_t>(input)))
+  : Value(static_cast<long long>(input))
 {
 }
 
 
 Value::Value(unsigned int input)
-  : prv(std::make_shared<ValueImpl>(static_cast<std::int64_t>(input)))
+  : Value(static_cast<long long>(input))
 {
 }
 
 
 Value::Value(long input)
-  : prv(std::make_shared<ValueImpl>(static_cast<std::int64_t>(input)))
+  : Value(static_cast<long long>(input))
 {
 }
 
 
 Value::Value(unsigned long input)
-  : prv(std::make_shared<ValueImpl>(static_cast<std::int64_t>(input)))
+  : Value(static_cast<long long>(input))
 {
 }
 
 
-Value::Value(long long input)
-  : prv(std::make_shared<ValueImpl>(static_cast<std::int64_t>(input)))
-{
+Value::Value(long long input) {
+  u.impl = new ValueImpl(static_cast<std::int64_t>(input));
+  u.type = 0;
 }
 
 
 Value::Value(unsigned long long input)
-  : prv(std::make_shared<ValueImpl>(static_cast<std::int64_t>(input)))
+  : Value(static_cast<long long>(input))
 {
 }
 
 
-Value::Value(const char *input)
-  : prv(std::make_shared<ValueImpl>(std::string(input)))
-{
+Value::Value(const char *input) {
+  ValueImpl::set_str(*this, input, std::strlen(input));
 }
 
 
-Value::Value(const std::string& input)
-  : prv(std::make_shared<ValueImpl>(input))
-{
+Value::Value(const std::string& input) {
+  ValueImpl::set_str(*this, input.data(), input.size());
 }
 
 
-Value::Value(Type _type)
-  : prv(std::make_shared<ValueImpl>(_type))
-{
+Value::Value(Type _type) {
+  switch (_type)
+  {
+  case Type::Null:
+  case Type::Bool:
+    u.b = false;
+    u.type = static_cast<unsigned char>(_type);
+    break;
+  default:
+    u.impl = new ValueImpl(_type);
+    u.type = 0;
+    break;
+  }
 }
 
 
 Value::Value(const Value& other)
-  : prv(other.prv)
+  : u(other.u),
+  // The comments are copied if they are changed in one of the Values.
+  cm(Comments::retain(other.cm)),
+  position(other.position)
 {
-  if (other.cm) {
-    // Clone the comments instead of sharing the reference. This way a change
-    // in the other Value does not affect the comments in this Value.
-    cm.reset(new Comments(*other.cm));
+  if (!u.type) {
+    ValueImpl::retain(u.impl);
   }
-  position = other.position;
 }
 
 
 Value::Value(Value&& other)
-  : prv(other.prv),
-    cm(other.cm)
+  : u(other.u),
+  cm(Comments::retain(other.cm)),
+  position(other.position)
 {
-  position = other.position;
+  if (!u.type) {
+    ValueImpl::retain(u.impl);
+  }
 }
 
 
@@ -309,15 +1155,21 @@ Value::Value(MapProxy&& other)
 }
 
 
-Value::Value(std::shared_ptr<ValueImpl> _prv, std::shared_ptr<Comments> _cm, Position pos)
-  : prv(_prv),
-    cm(_cm),
-    position(pos)
+// Takes over one reference to each of _impl and _cm.
+Value::Value(ValueImpl *_impl, Comments *_cm, Position pos)
+  : cm(_cm),
+  position(pos)
 {
+  u.impl = _impl;
+  u.type = 0;
 }
 
 
 Value::~Value() {
+  if (!u.type) {
+    ValueImpl::release(u.impl);
+  }
+  Comments::release(cm);
 }
 
 
@@ -328,7 +1180,7 @@ Value& Value::operator=(const Value& other) {
     this->set_comments(other);
   }
 
-  this->prv = other.prv;
+  ValueImpl::assign(this->u, other.u);
 
   return *this;
 }
@@ -338,25 +1190,28 @@ Value& Value::operator=(Value&& other) {
   // So that comments are kept when assigning a Value to a new key in a map,
   // or to a variable that has not been assigned any other value yet.
   if (!this->defined()) {
-    this->cm = other.cm;
+    Comments::assign(this->cm, other.cm);
     this->position = other.position;
   }
 
-  this->prv = other.prv;
+  ValueImpl::assign(this->u, other.u);
 
   return *this;
 }
 
 
 const Value& Value::at(const std::string& name) const {
-  switch (prv->type)
+  switch (type())
   {
   case Type::Undefined:
     throw index_out_of_bounds("Key not found.");
   case Type::Map:
-    try {
-      return prv->m->m.at(name);
-    } catch(const std::out_of_range&) {}
+    {
+      auto elem = u.impl->m->find(name);
+      if (elem) {
+        return elem->second;
+      }
+    }
     throw index_out_of_bounds("Key not found.");
   default:
     throw type_mismatch("Must be of type Map for that operation.");
@@ -365,14 +1220,17 @@ const Value& Value::at(const std::string& name) const {
 
 
 Value& Value::at(const std::string& name) {
-  switch (prv->type)
+  switch (type())
   {
   case Type::Undefined:
     throw index_out_of_bounds("Key not found.");
   case Type::Map:
-    try {
-      return prv->m->m.at(name);
-    } catch(const std::out_of_range&) {}
+    {
+      auto elem = u.impl->m->find(name);
+      if (elem) {
+        return elem->second;
+      }
+    }
     throw index_out_of_bounds("Key not found.");
   default:
     throw type_mismatch("Must be of type Map for that operation.");
@@ -390,15 +1248,57 @@ Value& Value::at(const char *name) {
 }
 
 
+const Value *Value::find(const char *key, size_t keySize) const {
+  switch (type())
+  {
+  case Type::Undefined:
+    return nullptr;
+  case Type::Map:
+    {
+      auto elem = u.impl->m->find(key, keySize);
+      return elem ? &elem->second : nullptr;
+    }
+  default:
+    throw type_mismatch("Must be of type Undefined or Map for that operation.");
+  }
+}
+
+
+Value *Value::find(const char *key, size_t keySize) {
+  return const_cast<Value*>(static_cast<const Value*>(this)->find(key,
+    keySize));
+}
+
+
+const Value *Value::find(const char *key) const {
+  return find(key, std::strlen(key));
+}
+
+
+Value *Value::find(const char *key) {
+  return find(key, std::strlen(key));
+}
+
+
+const Value *Value::find(const std::string& key) const {
+  return find(key.data(), key.size());
+}
+
+
+Value *Value::find(const std::string& key) {
+  return find(key.data(), key.size());
+}
+
+
 const Value Value::operator[](const std::string& name) const {
-  if (prv->type == Type::Undefined) {
+  if (type() == Type::Undefined) {
     return Value();
-  } else if (prv->type == Type::Map) {
-    auto it = prv->m->m.find(name);
-    if (it == prv->m->m.end()) {
+  } else if (type() == Type::Map) {
+    auto elem = u.impl->m->find(name);
+    if (!elem) {
       return Value();
     }
-    return it->second;
+    return elem->second;
   }
 
   throw type_mismatch("Must be of type Undefined or Map for that operation.");
@@ -406,19 +1306,18 @@ const Value Value::operator[](const std::string& name) const {
 
 
 MapProxy Value::operator[](const std::string& name) {
-  if (prv->type == Type::Undefined) {
-    prv->~ValueImpl();
-    // Recreate the private object using the same memory block.
-    new(&(*prv)) ValueImpl(Type::Map);
-  } else if (prv->type != Type::Map) {
+  if (type() == Type::Undefined) {
+    // Converted in place, so that all copies of this Value see the change.
+    u.impl->convert(Type::Map);
+  } else if (type() != Type::Map) {
     throw type_mismatch("Must be of type Undefined or Map for that operation.");
   }
 
-  auto it = prv->m->m.find(name);
-  if (it == prv->m->m.end()) {
-    return MapProxy(prv, name, 0);
+  auto elem = u.impl->m->find(name);
+  if (!elem) {
+    return MapProxy(u.impl, name, 0);
   }
-  return MapProxy(prv, name, &it->second);
+  return MapProxy(u.impl, name, &elem->second);
 }
 
 
@@ -443,7 +1342,7 @@ MapProxy Value::operator[](char *input) {
 
 
 const Value& Value::operator[](int index) const {
-  switch (prv->type)
+  switch (type())
   {
   case Type::Undefined:
     throw index_out_of_bounds("Index out of bounds.");
@@ -453,16 +1352,12 @@ const Value& Value::operator[](int index) const {
       throw index_out_of_bounds("Index out of bounds.");
     }
 
-    switch (prv->type)
+    switch (type())
     {
     case Type::Vector:
-      return prv->v[0][index];
+      return u.impl->v[0][index];
     case Type::Map:
-      {
-        auto it = prv->m->m.find(prv->m->v[index]);
-        assert(it != prv->m->m.end());
-        return it->second;
-      }
+      return u.impl->m->elems[index]->second;
     default:
       break;
     }
@@ -473,7 +1368,7 @@ const Value& Value::operator[](int index) const {
 
 
 Value& Value::operator[](int index) {
-  switch (prv->type)
+  switch (type())
   {
   case Type::Undefined:
     throw index_out_of_bounds("Index out of bounds.");
@@ -483,16 +1378,12 @@ Value& Value::operator[](int index) {
       throw index_out_of_bounds("Index out of bounds.");
     }
 
-    switch (prv->type)
+    switch (type())
     {
     case Type::Vector:
-      return prv->v[0][index];
+      return u.impl->v[0][index];
     case Type::Map:
-      {
-        auto it = prv->m->m.find(prv->m->v[index]);
-        assert(it != prv->m->m.end());
-        return it->second;
-      }
+      return u.impl->m->elems[index]->second;
     default:
       break;
     }
@@ -585,23 +1476,24 @@ std::string operator+(const Value& a, const std::string &b) {
 
 
 Value operator+(const Value& a, const Value& b) {
-  if (a.prv->type == Type::Double && b.prv->type == Type::Int64) {
-    return a.prv->d + b.prv->i;
-  } else if (a.prv->type == Type::Int64 && b.prv->type == Type::Double) {
-    return a.prv->i + b.prv->d;
+  if (a.type() == Type::Double && b.type() == Type::Int64) {
+    return a.u.impl->d + b.u.impl->i;
+  } else if (a.type() == Type::Int64 && b.type() == Type::Double) {
+    return a.u.impl->i + b.u.impl->d;
   }
 
-  if (a.prv->type != b.prv->type) {
+  if (a.type() != b.type()) {
     throw type_mismatch("The values must be of the same type for this operation.");
   }
 
-  switch (a.prv->type) {
+  switch (a.type()) {
   case Type::Double:
-    return a.prv->d + b.prv->d;
+    return a.u.impl->d + b.u.impl->d;
   case Type::Int64:
-    return a.prv->i + b.prv->i;
+    return a.u.impl->i + b.u.impl->i;
   case Type::String:
-    return *a.prv->s + *b.prv->s;
+    return Value::ValueImpl::str(a).append(Value::ValueImpl::str_data(b),
+      Value::ValueImpl::str_size(b));
   default:
     break;
   }
@@ -611,23 +1503,23 @@ Value operator+(const Value& a, const Value& b) {
 
 
 bool operator<(const Value& a, const Value& b) {
-  if (a.prv->type == Type::Double && b.prv->type == Type::Int64) {
-    return a.prv->d < b.prv->i;
-  } else if (a.prv->type == Type::Int64 && b.prv->type == Type::Double) {
-    return a.prv->i < b.prv->d;
+  if (a.type() == Type::Double && b.type() == Type::Int64) {
+    return a.u.impl->d < b.u.impl->i;
+  } else if (a.type() == Type::Int64 && b.type() == Type::Double) {
+    return a.u.impl->i < b.u.impl->d;
   }
 
-  if (a.prv->type != b.prv->type) {
+  if (a.type() != b.type()) {
     throw type_mismatch("The values must be of the same type for this operation.");
   }
 
-  switch (a.prv->type) {
+  switch (a.type()) {
   case Type::Double:
-    return a.prv->d < b.prv->d;
+    return a.u.impl->d < b.u.impl->d;
   case Type::Int64:
-    return a.prv->i < b.prv->i;
+    return a.u.impl->i < b.u.impl->i;
   case Type::String:
-    return *a.prv->s < *b.prv->s;
+    return Value::ValueImpl::str_compare(a, b) < 0;
   default:
     break;
   }
@@ -637,23 +1529,23 @@ bool operator<(const Value& a, const Value& b) {
 
 
 bool operator>(const Value& a, const Value& b) {
-  if (a.prv->type == Type::Double && b.prv->type == Type::Int64) {
-    return a.prv->d > b.prv->i;
-  } else if (a.prv->type == Type::Int64 && b.prv->type == Type::Double) {
-    return a.prv->i > b.prv->d;
+  if (a.type() == Type::Double && b.type() == Type::Int64) {
+    return a.u.impl->d > b.u.impl->i;
+  } else if (a.type() == Type::Int64 && b.type() == Type::Double) {
+    return a.u.impl->i > b.u.impl->d;
   }
 
-  if (a.prv->type != b.prv->type) {
+  if (a.type() != b.type()) {
     throw type_mismatch("The values must be of the same type for this operation.");
   }
 
-  switch (a.prv->type) {
+  switch (a.type()) {
   case Type::Double:
-    return a.prv->d > b.prv->d;
+    return a.u.impl->d > b.u.impl->d;
   case Type::Int64:
-    return a.prv->i > b.prv->i;
+    return a.u.impl->i > b.u.impl->i;
   case Type::String:
-    return *a.prv->s > *b.prv->s;
+    return Value::ValueImpl::str_compare(a, b) > 0;
   default:
     break;
   }
@@ -663,23 +1555,23 @@ bool operator>(const Value& a, const Value& b) {
 
 
 bool operator<=(const Value& a, const Value& b) {
-  if (a.prv->type == Type::Double && b.prv->type == Type::Int64) {
-    return a.prv->d <= b.prv->i;
-  } else if (a.prv->type == Type::Int64 && b.prv->type == Type::Double) {
-    return a.prv->i <= b.prv->d;
+  if (a.type() == Type::Double && b.type() == Type::Int64) {
+    return a.u.impl->d <= b.u.impl->i;
+  } else if (a.type() == Type::Int64 && b.type() == Type::Double) {
+    return a.u.impl->i <= b.u.impl->d;
   }
 
-  if (a.prv->type != b.prv->type) {
+  if (a.type() != b.type()) {
     throw type_mismatch("The values must be of the same type for this operation.");
   }
 
-  switch (a.prv->type) {
+  switch (a.type()) {
   case Type::Double:
-    return a.prv->d <= b.prv->d;
+    return a.u.impl->d <= b.u.impl->d;
   case Type::Int64:
-    return a.prv->i <= b.prv->i;
+    return a.u.impl->i <= b.u.impl->i;
   case Type::String:
-    return *a.prv->s <= *b.prv->s;
+    return Value::ValueImpl::str_compare(a, b) <= 0;
   default:
     break;
   }
@@ -689,23 +1581,23 @@ bool operator<=(const Value& a, const Value& b) {
 
 
 bool operator>=(const Value& a, const Value& b) {
-  if (a.prv->type == Type::Double && b.prv->type == Type::Int64) {
-    return a.prv->d >= b.prv->i;
-  } else if (a.prv->type == Type::Int64 && b.prv->type == Type::Double) {
-    return a.prv->i >= b.prv->d;
+  if (a.type() == Type::Double && b.type() == Type::Int64) {
+    return a.u.impl->d >= b.u.impl->i;
+  } else if (a.type() == Type::Int64 && b.type() == Type::Double) {
+    return a.u.impl->i >= b.u.impl->d;
   }
 
-  if (a.prv->type != b.prv->type) {
+  if (a.type() != b.type()) {
     throw type_mismatch("The values must be of the same type for this operation.");
   }
 
-  switch (a.prv->type) {
+  switch (a.type()) {
   case Type::Double:
-    return a.prv->d >= b.prv->d;
+    return a.u.impl->d >= b.u.impl->d;
   case Type::Int64:
-    return a.prv->i >= b.prv->i;
+    return a.u.impl->i >= b.u.impl->i;
   case Type::String:
-    return *a.prv->s >= *b.prv->s;
+    return Value::ValueImpl::str_compare(a, b) >= 0;
   default:
     break;
   }
@@ -715,32 +1607,32 @@ bool operator>=(const Value& a, const Value& b) {
 
 
 bool operator==(const Value& a, const Value& b) {
-  if (a.prv->type == Type::Double && b.prv->type == Type::Int64) {
-    return a.prv->d == b.prv->i;
-  } else if (a.prv->type == Type::Int64 && b.prv->type == Type::Double) {
-    return a.prv->i == b.prv->d;
+  if (a.type() == Type::Double && b.type() == Type::Int64) {
+    return a.u.impl->d == b.u.impl->i;
+  } else if (a.type() == Type::Int64 && b.type() == Type::Double) {
+    return a.u.impl->i == b.u.impl->d;
   }
 
-  if (a.prv->type != b.prv->type) {
+  if (a.type() != b.type()) {
     return false;
   }
 
-  switch (a.prv->type) {
+  switch (a.type()) {
   case Type::Undefined:
   case Type::Null:
     return true;
   case Type::Bool:
-    return a.prv->b == b.prv->b;
+    return a.u.b == b.u.b;
   case Type::Double:
-    return a.prv->d == b.prv->d;
+    return a.u.impl->d == b.u.impl->d;
   case Type::String:
-    return *a.prv->s == *b.prv->s;
+    return Value::ValueImpl::str_compare(a, b) == 0;
   case Type::Vector:
-    return a.prv->v == b.prv->v;
+    return a.u.impl->v == b.u.impl->v;
   case Type::Map:
-    return a.prv->m == b.prv->m;
+    return a.u.impl->m == b.u.impl->m;
   case Type::Int64:
-    return a.prv->i == b.prv->i;
+    return a.u.impl->i == b.u.impl->i;
   }
 
   assert(!"Unknown type");
@@ -755,21 +1647,21 @@ bool operator!=(const Value& a, const Value& b) {
 
 
 Value operator-(const Value& a, const Value& b) {
-  if (a.prv->type == Type::Double && b.prv->type == Type::Int64) {
-    return a.prv->d - b.prv->i;
-  } else if (a.prv->type == Type::Int64 && b.prv->type == Type::Double) {
-    return a.prv->i - b.prv->d;
+  if (a.type() == Type::Double && b.type() == Type::Int64) {
+    return a.u.impl->d - b.u.impl->i;
+  } else if (a.type() == Type::Int64 && b.type() == Type::Double) {
+    return a.u.impl->i - b.u.impl->d;
   }
 
-  if (a.prv->type != b.prv->type) {
+  if (a.type() != b.type()) {
     throw type_mismatch("The values must be of the same type for this operation.");
   }
 
-  switch (a.prv->type) {
+  switch (a.type()) {
   case Type::Double:
-    return a.prv->d - b.prv->d;
+    return a.u.impl->d - b.u.impl->d;
   case Type::Int64:
-    return a.prv->i - b.prv->i;
+    return a.u.impl->i - b.u.impl->i;
   default:
     break;
   }
@@ -779,21 +1671,21 @@ Value operator-(const Value& a, const Value& b) {
 
 
 Value operator*(const Value& a, const Value& b) {
-  if (a.prv->type == Type::Double && b.prv->type == Type::Int64) {
-    return a.prv->d * b.prv->i;
-  } else if (a.prv->type == Type::Int64 && b.prv->type == Type::Double) {
-    return a.prv->i * b.prv->d;
+  if (a.type() == Type::Double && b.type() == Type::Int64) {
+    return a.u.impl->d * b.u.impl->i;
+  } else if (a.type() == Type::Int64 && b.type() == Type::Double) {
+    return a.u.impl->i * b.u.impl->d;
   }
 
-  if (a.prv->type != b.prv->type) {
+  if (a.type() != b.type()) {
     throw type_mismatch("The values must be of the same type for this operation.");
   }
 
-  switch (a.prv->type) {
+  switch (a.type()) {
   case Type::Double:
-    return a.prv->d * b.prv->d;
+    return a.u.impl->d * b.u.impl->d;
   case Type::Int64:
-    return a.prv->i * b.prv->i;
+    return a.u.impl->i * b.u.impl->i;
   default:
     break;
   }
@@ -803,21 +1695,21 @@ Value operator*(const Value& a, const Value& b) {
 
 
 Value operator/(const Value& a, const Value& b) {
-  if (a.prv->type == Type::Double && b.prv->type == Type::Int64) {
-    return a.prv->d / b.prv->i;
-  } else if (a.prv->type == Type::Int64 && b.prv->type == Type::Double) {
-    return a.prv->i / b.prv->d;
+  if (a.type() == Type::Double && b.type() == Type::Int64) {
+    return a.u.impl->d / b.u.impl->i;
+  } else if (a.type() == Type::Int64 && b.type() == Type::Double) {
+    return a.u.impl->i / b.u.impl->d;
   }
 
-  if (a.prv->type != b.prv->type) {
+  if (a.type() != b.type()) {
     throw type_mismatch("The values must be of the same type for this operation.");
   }
 
-  switch (a.prv->type) {
+  switch (a.type()) {
   case Type::Double:
-    return a.prv->d / b.prv->d;
+    return a.u.impl->d / b.u.impl->d;
   case Type::Int64:
-    return a.prv->i / b.prv->i;
+    return a.u.impl->i / b.u.impl->i;
   default:
     break;
   }
@@ -827,11 +1719,11 @@ Value operator/(const Value& a, const Value& b) {
 
 
 Value operator%(const Value& a, const Value& b) {
-  if (a.prv->type != b.prv->type || a.prv->type != Type::Int64) {
+  if (a.type() != b.type() || a.type() != Type::Int64) {
     throw type_mismatch("The values must be of the Int64 type for this operation.");
   }
 
-  return a.prv->i % b.prv->i;
+  return a.u.impl->i % b.u.impl->i;
 }
 
 
@@ -871,35 +1763,36 @@ Value& Value::operator+=(const char *b) {
 
 
 Value& Value::operator+=(const std::string& b) {
-  if (prv->type != Type::String) {
+  if (type() != Type::String) {
     throw type_mismatch("The value must be of type String for this operation.");
   }
 
-  *prv->s += b;
+  ValueImpl::str_append(*this, b.data(), b.size());
 
   return *this;
 }
 
 
 Value& Value::operator+=(const Value& b) {
-  if (prv->type == Type::Double && b.prv->type == Type::Int64) {
-    prv->d += b.prv->i;
-  } else if (prv->type == Type::Int64 && b.prv->type == Type::Double) {
-    prv->i += static_cast<int64_t>(b.prv->d);
+  if (type() == Type::Double && b.type() == Type::Int64) {
+    u.impl->d += b.u.impl->i;
+  } else if (type() == Type::Int64 && b.type() == Type::Double) {
+    u.impl->i += static_cast<int64_t>(b.u.impl->d);
   } else {
-    if (prv->type != b.prv->type) {
+    if (type() != b.type()) {
       throw type_mismatch("The values must be of the same type for this operation.");
     }
 
-    switch (prv->type) {
+    switch (type()) {
     case Type::Double:
-      prv->d += b.prv->d;
+      u.impl->d += b.u.impl->d;
       break;
     case Type::Int64:
-      prv->i += b.prv->i;
+      u.impl->i += b.u.impl->i;
       break;
     case Type::String:
-      *prv->s += *b.prv->s;
+      ValueImpl::str_append(*this, ValueImpl::str_data(b),
+        ValueImpl::str_size(b));
       break;
     default:
       throw type_mismatch("The values must be of type Double, Int64 or String for this operation.");
@@ -919,21 +1812,21 @@ Value& Value::operator-=(const Value& b) {
 
 
 Value& Value::operator*=(const Value& b) {
-  if (prv->type == Type::Double && b.prv->type == Type::Int64) {
-    prv->d *= b.prv->i;
-  } else if (prv->type == Type::Int64 && b.prv->type == Type::Double) {
-    prv->i = static_cast<int64_t>(prv->i * b.prv->d);
+  if (type() == Type::Double && b.type() == Type::Int64) {
+    u.impl->d *= b.u.impl->i;
+  } else if (type() == Type::Int64 && b.type() == Type::Double) {
+    u.impl->i = static_cast<int64_t>(u.impl->i * b.u.impl->d);
   } else {
-    if (prv->type != b.prv->type) {
+    if (type() != b.type()) {
       throw type_mismatch("The values must be of the same type for this operation.");
     }
 
-    switch (prv->type) {
+    switch (type()) {
     case Type::Double:
-      prv->d *= b.prv->d;
+      u.impl->d *= b.u.impl->d;
       break;
     case Type::Int64:
-      prv->i *= b.prv->i;
+      u.impl->i *= b.u.impl->i;
       break;
     default:
       throw type_mismatch("The values must be of type Double or Int64 for this operation.");
@@ -946,21 +1839,21 @@ Value& Value::operator*=(const Value& b) {
 
 
 Value& Value::operator/=(const Value& b) {
-  if (prv->type == Type::Double && b.prv->type == Type::Int64) {
-    prv->d /= b.prv->i;
-  } else if (prv->type == Type::Int64 && b.prv->type == Type::Double) {
-    prv->i = static_cast<int64_t>(prv->i / b.prv->d);
+  if (type() == Type::Double && b.type() == Type::Int64) {
+    u.impl->d /= b.u.impl->i;
+  } else if (type() == Type::Int64 && b.type() == Type::Double) {
+    u.impl->i = static_cast<int64_t>(u.impl->i / b.u.impl->d);
   } else {
-    if (prv->type != b.prv->type) {
+    if (type() != b.type()) {
       throw type_mismatch("The values must be of the same type for this operation.");
     }
 
-    switch (prv->type) {
+    switch (type()) {
     case Type::Double:
-      prv->d /= b.prv->d;
+      u.impl->d /= b.u.impl->d;
       break;
     case Type::Int64:
-      prv->i /= b.prv->i;
+      u.impl->i /= b.u.impl->i;
       break;
     default:
       throw type_mismatch("The values must be of type Double or Int64 for this operation.");
@@ -973,22 +1866,22 @@ Value& Value::operator/=(const Value& b) {
 
 
 Value& Value::operator%=(const Value& b) {
-  if (prv->type != b.prv->type || prv->type != Type::Int64) {
+  if (type() != b.type() || type() != Type::Int64) {
     throw type_mismatch("The values must be of the Int64 type for this operation.");
   }
 
-  prv->i %= b.prv->i;
+  u.impl->i %= b.u.impl->i;
 
   return *this;
 }
 
 
 Value Value::operator+() const {
-  switch (prv->type) {
+  switch (type()) {
   case Type::Double:
-    return prv->d;
+    return u.impl->d;
   case Type::Int64:
-    return prv->i;
+    return u.impl->i;
   default:
     throw type_mismatch("The value must be of type Double or Int64 for this operation.");
     break;
@@ -999,11 +1892,11 @@ Value Value::operator+() const {
 
 
 Value Value::operator-() const {
-  switch (prv->type) {
+  switch (type()) {
   case Type::Double:
-    return -prv->d;
+    return -u.impl->d;
   case Type::Int64:
-    return -prv->i;
+    return -u.impl->i;
   default:
     throw type_mismatch("The value must be of type Double or Int64 for this operation.");
     break;
@@ -1014,12 +1907,12 @@ Value Value::operator-() const {
 
 
 Value& Value::operator++() {
-  switch (prv->type) {
+  switch (type()) {
   case Type::Double:
-    prv->d++;
+    u.impl->d++;
     break;
   case Type::Int64:
-    prv->i++;
+    u.impl->i++;
     break;
   default:
     throw type_mismatch("The values must be of type Double or Int64 for this operation.");
@@ -1031,12 +1924,12 @@ Value& Value::operator++() {
 
 
 Value& Value::operator--() {
-  switch (prv->type) {
+  switch (type()) {
   case Type::Double:
-    prv->d--;
+    u.impl->d--;
     break;
   case Type::Int64:
-    prv->i--;
+    u.impl->i--;
     break;
   default:
     throw type_mismatch("The values must be of type Double or Int64 for this operation.");
@@ -1050,14 +1943,14 @@ Value& Value::operator--() {
 Value Value::operator++(int) {
   Value ret;
 
-  switch (prv->type) {
+  switch (type()) {
   case Type::Double:
-    ret = prv->d;
-    prv->d++;
+    ret = u.impl->d;
+    u.impl->d++;
     break;
   case Type::Int64:
-    ret = prv->i;
-    prv->i++;
+    ret = u.impl->i;
+    u.impl->i++;
     break;
   default:
     throw type_mismatch("The values must be of type Double or Int64 for this operation.");
@@ -1071,14 +1964,14 @@ Value Value::operator++(int) {
 Value Value::operator--(int) {
   Value ret;
 
-  switch (prv->type) {
+  switch (type()) {
   case Type::Double:
-    ret = prv->d;
-    prv->d--;
+    ret = u.impl->d;
+    u.impl->d--;
     break;
   case Type::Int64:
-    ret = prv->i;
-    prv->i--;
+    ret = u.impl->i;
+    u.impl->i--;
     break;
   default:
     throw type_mismatch("The values must be of type Double or Int64 for this operation.");
@@ -1090,14 +1983,14 @@ Value Value::operator--(int) {
 
 
 Value::operator bool() const {
-  switch (prv->type)
+  switch (type())
   {
   case Type::Double:
-    return !!prv->d;
+    return !!u.impl->d;
   case Type::Int64:
-    return !!prv->i;
+    return !!u.impl->i;
   case Type::Bool:
-    return prv->b;
+    return u.b;
   default:
     break;
   }
@@ -1112,12 +2005,12 @@ Value::operator float() const {
 
 
 Value::operator double() const {
-  switch (prv->type)
+  switch (type())
   {
   case Type::Double:
-    return prv->d;
+    return u.impl->d;
   case Type::Int64:
-    return static_cast<double>(prv->i);
+    return static_cast<double>(u.impl->i);
   default:
     break;
   }
@@ -1150,12 +2043,12 @@ HJSON_CONV_INT_IMPL(unsigned long long)
 
 
 Value::operator long long() const {
-  switch (prv->type)
+  switch (type())
   {
   case Type::Double:
-    return static_cast<long long>(prv->d);
+    return static_cast<long long>(u.impl->d);
   case Type::Int64:
-    return prv->i;
+    return u.impl->i;
   default:
     break;
   }
@@ -1167,59 +2060,59 @@ Value::operator long long() const {
 
 
 Value::operator const char*() const {
-  if (prv->type != Type::String) {
+  if (type() != Type::String) {
     throw type_mismatch("Must be of type String for that operation.");
   }
 
-  return prv->s->c_str();
+  return ValueImpl::c_str(*this);
 }
 
 
 Value::operator std::string() const {
-  if (prv->type != Type::String) {
+  if (type() != Type::String) {
     throw type_mismatch("Must be of type String for that operation.");
   }
 
-  return *prv->s;
+  return ValueImpl::str(*this);
 }
 
 
 bool Value::defined() const {
-  return prv->type != Type::Undefined;
+  return type() != Type::Undefined;
 }
 
 
 bool Value::empty() const {
-  return (prv->type == Type::Undefined ||
-    prv->type == Type::Null ||
-    (prv->type == Type::String && prv->s->empty()) ||
-    (prv->type == Type::Vector && prv->v->empty()) ||
-    (prv->type == Type::Map && prv->m->m.empty()));
+  return (type() == Type::Undefined ||
+    type() == Type::Null ||
+    (type() == Type::String && !ValueImpl::str_size(*this)) ||
+    (type() == Type::Vector && u.impl->v->empty()) ||
+    (type() == Type::Map && u.impl->m->elems.empty()));
 }
 
 
 Type Value::type() const {
-  return prv->type;
+  return u.type ? static_cast<Type>(u.type) : u.impl->type;
 }
 
 
 bool Value::is_container() const {
-  return prv->type == Type::Vector || prv->type == Type::Map;
+  return type() == Type::Vector || type() == Type::Map;
 }
 
 
 bool Value::is_numeric() const {
-  return prv->type == Type::Double || prv->type == Type::Int64;
+  return type() == Type::Double || type() == Type::Int64;
 }
 
 
 size_t Value::size() const {
-  switch (prv->type)
+  switch (type())
   {
   case Type::Vector:
-    return prv->v->size();
+    return u.impl->v->size();
   case Type::Map:
-    return prv->m->m.size();
+    return u.impl->m->elems.size();
   default:
     break;
   }
@@ -1237,13 +2130,13 @@ bool Value::deep_equal(const Value& other) const {
     return false;
   }
 
-  switch (prv->type)
+  switch (type())
   {
   case Type::Vector:
     {
-      auto itA = this->prv->v->begin();
-      auto endA = this->prv->v->end();
-      auto itB = other.prv->v->begin();
+      auto itA = u.impl->v->begin();
+      auto endA = u.impl->v->end();
+      auto itB = other.u.impl->v->begin();
       while (itA != endA) {
         if (!itA->deep_equal(*itB)) {
           return false;
@@ -1255,14 +2148,11 @@ bool Value::deep_equal(const Value& other) const {
     return true;
 
   case Type::Map:
-    {
-      auto itA = this->begin(), endA = this->end(), itB = other.begin();
-      while (itA != endA) {
-        if (!itA->second.deep_equal(itB->second)) {
-          return false;
-        }
-        ++itA;
-        ++itB;
+    // The insertion order is not compared.
+    for (auto elemA : u.impl->m->elems) {
+      auto elemB = other.u.impl->m->find(elemA->first);
+      if (!elemB || !elemA->second.deep_equal(elemB->second)) {
+        return false;
       }
     }
     return true;
@@ -1276,44 +2166,87 @@ bool Value::deep_equal(const Value& other) const {
 
 
 Value Value::clone() const {
-  switch (prv->type) {
+  switch (type()) {
   case Type::Vector:
     {
+      // Stays Undefined if the vector is empty.
       Value ret;
       for (int index = 0; index < int(size()); ++index) {
         ret.push_back(operator[](index).clone());
       }
       ret.set_comments(*this);
+      ret._own_comments();
       return ret;
     }
 
   case Type::Map:
     {
+      // Stays Undefined if the map is empty.
       Value ret;
-      for (int index = 0; (size_t)index < size(); ++index) {
-        ret[key(index)] = operator[](index).clone();
+      if (size()) {
+        ret.u.impl->convert(Type::Map);
+        auto m = ret.u.impl->m;
+        // The keys are already known to be unique.
+        m->elems.reserve(size());
+        for (auto it = begin(); it != end(); ++it) {
+          m->insert(std::string(it->first), it->second.clone());
+        }
       }
       ret.set_comments(*this);
+      ret._own_comments();
+      return ret;
+    }
+
+  case Type::String:
+    if (!u.type && (u.impl->borrowed || u.impl->inArena)) {
+      // The clone must not depend on the buffer that the string refers to.
+      Value ret(ValueImpl::str(*this));
+      ret.set_comments(*this);
+      ret.position = position;
+      ret._own_comments();
       return ret;
     }
+    break;
 
   default:
+    if (!u.type && u.impl->inArena) {
+      // The clone must not depend on the arena.
+      Value ret;
+      if (type() == Type::Double) {
+        ret = Value(u.impl->d);
+      } else if (type() == Type::Int64) {
+        ret = Value(static_cast<long long>(u.impl->i));
+      }
+      ret.set_comments(*this);
+      ret.position = position;
+      ret._own_comments();
+      return ret;
+    }
     break;
   }
 
-  return *this;
+  Value ret(*this);
+  ret._own_comments();
+  return ret;
+}
+
+
+// Makes the comments independent of any input buffer.
+void Value::_own_comments() {
+  if (cm && cm->borrowed()) {
+    Comments::unshare(cm)->own();
+  }
 }
 
 
 void Value::clear() {
-  switch (prv->type) {
+  switch (type()) {
   case Type::Vector:
-    prv->v->clear();
+    u.impl->v->clear();
     break;
 
   case Type::Map:
-    prv->m->m.clear();
-    prv->m->v.clear();
+    u.impl->m->clear();
     break;
 
   default:
@@ -1323,7 +2256,7 @@ void Value::clear() {
 
 
 void Value::erase(int index) {
-  switch (prv->type)
+  switch (type())
   {
   case Type::Undefined:
   case Type::Vector:
@@ -1332,17 +2265,16 @@ void Value::erase(int index) {
       throw index_out_of_bounds("Index out of bounds.");
     }
 
-    switch (prv->type)
+    switch (type())
     {
     case Type::Vector:
       {
-        prv->v->erase(prv->v->begin() + index);
+        u.impl->v->erase(u.impl->v->begin() + index);
       }
       break;
     case Type::Map:
       {
-        prv->m->m.erase(prv->m->v[index]);
-        prv->m->v.erase(prv->m->v.begin() + index);
+        u.impl->m->erase(index);
       }
       break;
     default:
@@ -1357,20 +2289,19 @@ void Value::erase(int index) {
 
 
 void Value::push_back(const Value& other) {
-  if (prv->type == Type::Undefined) {
-    prv->~ValueImpl();
-    // Recreate the private object using the same memory block.
-    new(&(*prv)) ValueImpl(Type::Vector);
-  } else if (prv->type != Type::Vector) {
+  if (type() == Type::Undefined) {
+    // Converted in place, so that all copies of this Value see the change.
+    u.impl->convert(Type::Vector);
+  } else if (type() != Type::Vector) {
     throw type_mismatch("Must be of type Undefined or Vector for that operation.");
   }
 
-  prv->v->push_back(other);
+  u.impl->v->push_back(other);
 }
 
 
 void Value::move(int from, int to) {
-  switch (prv->type)
+  switch (type())
   {
   case Type::Undefined:
   case Type::Vector:
@@ -1383,30 +2314,21 @@ void Value::move(int from, int to) {
       return;
     }
 
-    switch (prv->type)
+    switch (type())
     {
     case Type::Vector:
       {
-        auto it = prv->v->begin();
+        auto it = u.impl->v->begin();
 
-        prv->v->insert(it + to, it[from]);
+        u.impl->v->insert(it + to, it[from]);
         if (to < from) {
           ++from;
         }
-        prv->v->erase(prv->v->begin() + from);
+        u.impl->v->erase(u.impl->v->begin() + from);
       }
       break;
     case Type::Map:
-      {
-        auto vec = &prv->m->v;
-        auto it = vec->begin();
-
-        vec->insert(it + to, it[from]);
-        if (to < from) {
-          ++from;
-        }
-        vec->erase(vec->begin() + from);
-      }
+      u.impl->m->move(from, to);
       break;
     default:
       break;
@@ -1420,84 +2342,64 @@ void Value::move(int from, int to) {
 
 
 std::string Value::key(int index) const {
-  switch (prv->type)
+  switch (type())
   {
   case Type::Undefined:
   case Type::Map:
     if (index < 0 || (size_t)index >= size()) {
       throw index_out_of_bounds("Index out of bounds.");
     }
-    return prv->m->v[index];
+    return u.impl->m->elems[index]->first;
   default:
     throw type_mismatch("Must be of type Map for that operation.");
   }
 }
 
 
-ValueMap::iterator Value::begin() {
-  if (prv->type != Type::Map) {
-    // Some C++ compilers might not allow comparing this to another
-    // default-constructed iterator.
+Value::ValueMap::iterator Value::begin() {
+  if (type() != Type::Map) {
     return ValueMap::iterator();
   }
 
-  return prv->m->m.begin();
+  return u.impl->m->begin();
 }
 
 
-ValueMap::iterator Value::end() {
-  if (prv->type != Type::Map) {
-    // Some C++ compilers might not allow comparing this to another
-    // default-constructed iterator.
+Value::ValueMap::iterator Value::end() {
+  if (type() != Type::Map) {
     return ValueMap::iterator();
   }
 
-  return prv->m->m.end();
+  return u.impl->m->end();
 }
 
 
-ValueMap::const_iterator Value::begin() const {
-  if (prv->type != Type::Map) {
-    // Some C++ compilers might not allow comparing this to another
-    // default-constructed iterator.
+Value::ValueMap::const_iterator Value::begin() const {
+  if (type() != Type::Map) {
     return ValueMap::const_iterator();
   }
 
-  return prv->m->m.begin();
+  return u.impl->m->begin();
 }
 
 
-ValueMap::const_iterator Value::end() const {
-  if (prv->type != Type::Map) {
-    // Some C++ compilers might not allow comparing this to another
-    // default-constructed iterator.
+Value::ValueMap::const_iterator Value::end() const {
+  if (type() != Type::Map) {
     return ValueMap::const_iterator();
   }
 
-  return prv->m->m.end();
+  return u.impl->m->end();
 }
 
 
 size_t Value::erase(const std::string &key) {
-  if (prv->type == Type::Undefined) {
+  if (type() == Type::Undefined) {
     return 0;
-  } else if (prv->type != Type::Map) {
+  } else if (type() != Type::Map) {
     throw type_mismatch("Must be of type Map for that operation.");
   }
 
-  size_t ret = prv->m->m.erase(key);
-
-  if (ret > 0) {
-    auto v = &prv->m->v;
-    auto it = std::find(v->begin(), v->end(), key);
-    if (it == v->end()) {
-      assert(!"Value found in map but not in vector");
-    } else {
-      v->erase(it);
-    }
-  }
-
-  return ret;
+  return u.impl->m->erase(key) ? 1 : 0;
 }
 
 
@@ -1507,37 +2409,39 @@ size_t Value::erase(const char *key) {
 
 
 double Value::to_double() const {
-  switch (prv->type) {
+  switch (type()) {
   case Type::Undefined:
   case Type::Null:
     return 0.0;
   case Type::Bool:
-    return (prv->b ? 1.0 : 0.0);
+    return (u.b ? 1.0 : 0.0);
   case Type::Double:
-    return prv->d;
+    return u.impl->d;
   case Type::Int64:
-    return static_cast<double>(prv->i);
+    return static_cast<double>(u.impl->i);
   case Type::String:
     {
       double ret;
 
 #if HJSON_USE_CHARCONV
-      const char *pCh = prv->s->c_str();
-      const char *pEnd = pCh + prv->s->size();
+      const char *pCh = ValueImpl::str_data(*this);
+      const char *pEnd = pCh + ValueImpl::str_size(*this);
 
       auto res = std::from_chars(pCh, pEnd, ret);
 
       if (res.ptr != pEnd || res.ec == std::errc::result_out_of_range) {
 #elif HJSON_USE_STRTOD
-      const char *pCh = prv->s->c_str();
+      // strtod() needs a null-terminated string.
+      std::string str = ValueImpl::str(*this);
+      const char *pCh = str.c_str();
       char *endptr;
       errno = 0;
 
       ret = std::strtod(pCh, &endptr);
 
-      if (errno || endptr - pCh != prv->s->size()) {
+      if (errno || endptr - pCh != str.size()) {
 #else
-      std::stringstream ss(*prv->s);
+      std::stringstream ss(ValueImpl::str(*this));
 
       // Make sure we expect dot (not comma) as decimal point.
       ss.imbue(std::locale::classic());
@@ -1560,37 +2464,39 @@ double Value::to_double() const {
 
 
 std::int64_t Value::to_int64() const {
-  switch (prv->type) {
+  switch (type()) {
   case Type::Undefined:
   case Type::Null:
     return 0;
   case Type::Bool:
-    return (prv->b ? 1 : 0);
+    return (u.b ? 1 : 0);
   case Type::Double:
-    return static_cast<std::int64_t>(prv->d);
+    return static_cast<std::int64_t>(u.impl->d);
   case Type::Int64:
-    return prv->i;
+    return u.impl->i;
   case Type::String:
     {
       std::int64_t ret;
 
 #if HJSON_USE_CHARCONV
-      const char *pCh = prv->s->c_str();
-      const char *pEnd = pCh + prv->s->size();
+      const char *pCh = ValueImpl::str_data(*this);
+      const char *pEnd = pCh + ValueImpl::str_size(*this);
 
       auto res = std::from_chars(pCh, pEnd, ret);
 
       if (res.ptr != pEnd || res.ec == std::errc::result_out_of_range) {
 #elif HJSON_USE_STRTOD
-      const char *pCh = prv->s->c_str();
+      // strtod() needs a null-terminated string.
+      std::string str = ValueImpl::str(*this);
+      const char *pCh = str.c_str();
       char *endptr;
       errno = 0;
 
       ret = std::strtoll(pCh, &endptr, 0);
 
-      if (errno || endptr - pCh != prv->s->size()) {
+      if (errno || endptr - pCh != str.size()) {
 #else
-      std::stringstream ss(*prv->s);
+      std::stringstream ss(ValueImpl::str(*this));
 
       // Avoid localization surprises.
       ss.imbue(std::locale::classic());
@@ -1614,19 +2520,19 @@ std::int64_t Value::to_int64() const {
 
 
 std::string Value::to_string() const {
-  switch (prv->type) {
+  switch (type()) {
   case Type::Undefined:
     return "";
   case Type::Null:
     return "null";
   case Type::Bool:
-    return (prv->b ? "true" : "false");
+    return (u.b ? "true" : "false");
   case Type::Double:
     {
 #if HJSON_USE_CHARCONV
       std::array<char, 32> buf;
 
-      auto res = std::to_chars(buf.data(), buf.data() + buf.size(), prv->d);
+      auto res = std::to_chars(buf.data(), buf.data() + buf.size(), u.impl->d);
 
       if (res.ptr - buf.data() >= buf.size() || res.ec != std::errc()) {
         return "";
@@ -1647,7 +2553,7 @@ std::string Value::to_string() const {
       return std::string(buf.data(), res.ptr);
 #elif HJSON_USE_STRTOD
       char buf[32];
-      int nChars = snprintf(buf, sizeof(buf), "%.15g", prv->d);
+      int nChars = snprintf(buf, sizeof(buf), "%.15g", u.impl->d);
 
       if (nChars < 0 || nChars >= static_cast<int>(sizeof(buf))) {
         return "";
@@ -1670,7 +2576,7 @@ std::string Value::to_string() const {
       oss.imbue(std::locale::classic());
       oss.precision(15);
 
-      oss << prv->d;
+      oss << u.impl->d;
 
       // Always output a decimal point. Done like this to avoid printing more
       // decimals than needed, which would be the result of using
@@ -1687,7 +2593,7 @@ std::string Value::to_string() const {
 #if HJSON_USE_CHARCONV
       std::array<char, 32> buf;
 
-      auto res = std::to_chars(buf.data(), buf.data() + buf.size(), prv->i);
+      auto res = std::to_chars(buf.data(), buf.data() + buf.size(), u.impl->i);
 
       if (res.ec != std::errc()) {
         return "";
@@ -1695,20 +2601,20 @@ std::string Value::to_string() const {
 
       return std::string(buf.data(), res.ptr);
 #elif HJSON_USE_STRTOD
-      return std::to_string(prv->i);
+      return std::to_string(u.impl->i);
 #else
       std::ostringstream oss;
 
       // Avoid localization surprises.
       oss.imbue(std::locale::classic());
 
-      oss << prv->i;
+      oss << u.impl->i;
 
       return oss.str();
 #endif
     }
   case Type::String:
-    return *prv->s;
+    return ValueImpl::str(*this);
   default:
     break;
   }
@@ -1718,20 +2624,17 @@ std::string Value::to_string() const {
 
 
 void Value::set_comment_before(const std::string& str) {
-  if (!cm) {
-    if (str.empty()) {
-      return;
-    }
-    cm.reset(new Comments());
+  if (!cm && str.empty()) {
+    return;
   }
 
-  cm->m_commentBefore = str;
+  Comments::unshare(cm)->set(Comments::Before, str.data(), str.size());
 }
 
 
 std::string Value::get_comment_before() const {
   if (cm) {
-    return cm->m_commentBefore;
+    return cm->get(Comments::Before);
   }
 
   return "";
@@ -1739,20 +2642,17 @@ std::string Value::get_comment_before() const {
 
 
 void Value::set_comment_key(const std::string& str) {
-  if (!cm) {
-    if (str.empty()) {
-      return;
-    }
-    cm.reset(new Comments());
+  if (!cm && str.empty()) {
+    return;
   }
 
-  cm->m_commentKey = str;
+  Comments::unshare(cm)->set(Comments::Key, str.data(), str.size());
 }
 
 
 std::string Value::get_comment_key() const {
   if (cm) {
-    return cm->m_commentKey;
+    return cm->get(Comments::Key);
   }
 
   return "";
@@ -1760,20 +2660,17 @@ std::string Value::get_comment_key() const {
 
 
 void Value::set_comment_inside(const std::string& str) {
-  if (!cm) {
-    if (str.empty()) {
-      return;
-    }
-    cm.reset(new Comments());
+  if (!cm && str.empty()) {
+    return;
   }
 
-  cm->m_commentInside = str;
+  Comments::unshare(cm)->set(Comments::Inside, str.data(), str.size());
 }
 
 
 std::string Value::get_comment_inside() const {
   if (cm) {
-    return cm->m_commentInside;
+    return cm->get(Comments::Inside);
   }
 
   return "";
@@ -1781,49 +2678,42 @@ std::string Value::get_comment_inside() const {
 
 
 void Value::set_comment_after(const std::string& str) {
-  if (!cm) {
-    if (str.empty()) {
-      return;
-    }
-    cm.reset(new Comments());
+  if (!cm && str.empty()) {
+    return;
   }
 
-  cm->m_commentAfter = str;
+  Comments::unshare(cm)->set(Comments::After, str.data(), str.size());
 }
 
 
 std::string Value::get_comment_after() const {
   if (cm) {
-    return cm->m_commentAfter;
+    return cm->get(Comments::After);
   }
 
   return "";
 }
 
 void Value::set_pos_item(size_t p) {
-  position.item = p;
-  // printf("%p: Set item position to %zu\n", (void*)this, position.item);
+  position.item = static_cast<std::uint32_t>(p);
+  // printf("%p: Set item position to %u\n", (void*)this, position.item);
 }
 int Value::get_pos_item() const {
-  // printf("%p: Get item position: %zu\n", (void*)this, position.item);
+  // printf("%p: Get item position: %u\n", (void*)this, position.item);
   return static_cast<int>(position.item);
 }
 void Value::set_pos_key(size_t p) {
-  position.key = p;
-  // printf("%p: Set key position to %zu\n", (void*)this, position.key);
+  position.key = static_cast<std::uint32_t>(p);
+  // printf("%p: Set key position to %u\n", (void*)this, position.key);
 }
 int Value::get_pos_key() const {
-  // printf("%p: Get key position: %zu\n", (void*)this, position.key);
+  // printf("%p: Get key position: %u\n", (void*)this, position.key);
   return static_cast<int>(position.key);
 }
 
 void Value::set_comments(const Value& other) {
   if (other.cm) {
-    if (!cm) {
-      cm.reset(new Comments());
-    }
-
-    *cm = *other.cm;
+    Comments::assign(cm, other.cm);
     position = other.position;
   } else {
     clear_comments();
@@ -1832,7 +2722,8 @@ void Value::set_comments(const Value& other) {
 
 
 void Value::clear_comments() {
-  cm.reset();
+  Comments::release(cm);
+  cm = nullptr;
   position.reset();
 }
 
@@ -1851,52 +2742,71 @@ Value& Value::assign_with_comments(Value&& other) {
   // If this object is of type Undefined set_comments() will be called in the
   // assignment operator, no need to call it here.
   if (defined()) {
-    cm = other.cm;
+    Comments::assign(cm, other.cm);
     position = other.position;
   }
   return operator=(std::move(other));
 }
 
 
-MapProxy::MapProxy(std::shared_ptr<ValueImpl> _parent, const std::string &_key,
+MapProxy::MapProxy(ValueImpl *_parent, const std::string &_key,
   Value *_pTarget)
-  : Value(_pTarget ? _pTarget->prv : std::make_shared<ValueImpl>(Type::Undefined),
-      _pTarget ? _pTarget->cm : 0, _pTarget ? _pTarget->position : Position()),
-    parentPrv(_parent),
+  : Value(Type::Null),
+    parentPrv(ValueImpl::retain(_parent)),
     key(_key),
-    pTarget(_pTarget),
     wasAssigned(false)
 {
+  if (_pTarget) {
+    ValueImpl::assign(u, _pTarget->u);
+    // Share the comments with the target instead of copying them.
+    cm = Comments::retain(_pTarget->cm);
+    position = _pTarget->position;
+  } else {
+    u.impl = new ValueImpl(Type::Undefined);
+    u.type = 0;
+  }
 }
 
 
-MapProxy::MapProxy(Value&& other)
-  : Value(std::move(other))
+MapProxy::MapProxy(const MapProxy& other)
+  : Value(other),
+    parentPrv(ValueImpl::retain(other.parentPrv)),
+    key(other.key),
+    wasAssigned(other.wasAssigned)
 {
 }
 
 
 MapProxy::~MapProxy() {
-  if (wasAssigned || !empty()) {
-    if (pTarget) {
-      // Can have changed due to assignment.
-      pTarget->prv = this->prv;
-      // In case cm was 0 but now has been created by a call to set_comment_x.
-      pTarget->cm = this->cm;
-      pTarget->position = this->position;
-    } else {
-      // If the key is new we must add it to the order vector also.
-      parentPrv->m->v.push_back(key);
-
+  // Comments set by a call to set_comment_x are no longer shared with the
+  // map element.
+  bool newComments = cm && cm->unique();
+
+  if (wasAssigned || !empty() || newComments) {
+    // Looked up again, because the map might have been changed since the
+    // MapProxy was created.
+    auto elem = parentPrv->m->find(key);
+    if (elem) {
+      // Can have changed due to assignment, or due to an operator like +=
+      // on a value that is stored inline.
+      ValueImpl::assign(elem->second.u, this->u);
+      Comments::assign(elem->second.cm, this->cm);
+      elem->second.position = this->position;
+    } else if (wasAssigned || !empty()) {
       // We waited until now because we don't want to insert a Value object of
       // type Undefined into the parent map, unless such an object was explicitly
       // assigned (e.g. `val["key"] = Hjson::Value()`).
       // Without this requirement, checking for the existence of an element
       // would create an Undefined element for that key if it didn't already exist
       // (e.g. `if (val["key"] == 1) {` would create an element for "key").
-      parentPrv->m->m.emplace(key, Value(this->prv, this->cm, this->position));
+      auto elem = parentPrv->m->insert(std::move(key), Value(Type::Null));
+      ValueImpl::assign(elem->second.u, this->u);
+      Comments::assign(elem->second.cm, this->cm);
+      elem->second.position = this->position;
     }
   }
+
+  ValueImpl::release(parentPrv);
 }
 
 
@@ -1938,7 +2848,7 @@ MapProxy& MapProxy::assign_with_comments(Value&& other) {
   // If this object is of type Undefined set_comments() will be called in the
   // assignment operator, no need to call it here.
   if (defined()) {
-    cm = other.cm;
+    Comments::assign(cm, other.cm);
     position = other.position;
   }
   return operator=(std::move(other));
@@ -1951,17 +2861,26 @@ Value Merge(const Value& base, const Value& ext) {
   if (!ext.defined()) {
     merged = base.clone();
   } else if (base.type() == Type::Map && ext.type() == Type::Map) {
-    for (size_t index = 0; index < ext.size(); ++index) {
-      if (base[ext.key(index)].defined()) {
-        merged[ext.key(index)] = Merge(base[ext.key(index)], ext[index]);
+    if (ext.size() || base.size()) {
+      merged = Value(Type::Map);
+    }
+
+    for (auto it = ext.begin(); it != ext.end(); ++it) {
+      auto baseElem = base.find(it->first);
+      if (baseElem && baseElem->defined()) {
+        ValueInternal::setElement(merged, std::string(it->first),
+          Merge(*baseElem, it->second));
       } else {
-        merged[ext.key(index)] = ext[index].clone();
+        ValueInternal::setElement(merged, std::string(it->first),
+          it->second.clone());
       }
     }
 
-    for (size_t index = 0; index < base.size(); ++index) {
-      if (!merged[base.key(index)].defined()) {
-        merged[base.key(index)] = base[index].clone();
+    for (auto it = base.begin(); it != base.end(); ++it) {
+      auto mergedElem = merged.find(it->first);
+      if (!mergedElem || !mergedElem->defined()) {
+        ValueInternal::setElement(merged, std::string(it->first),
+          it->second.clone());
       }
     }
 
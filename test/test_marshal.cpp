@@ -4,6 +4,7 @@
 #include <cstring>
 #include <vector>
 #include <algorithm>
+#include <memory>
 #include "hjson_test.h"
 
 
@@ -114,6 +115,212 @@ static Hjson::Value _getTestContent(std::string name, Hjson::DecoderOptions opt=
 }
 
 
+// Returns true if the values in a and b, which must have the same structure,
+// have the same positions.
+static bool _samePositions(const Hjson::Value& a, const Hjson::Value& b) {
+  if (a.get_pos_item() != b.get_pos_item() ||
+    a.get_pos_key() != b.get_pos_key())
+  {
+    return false;
+  }
+
+  for (int index = 0; index < int(a.size()); ++index) {
+    if (!_samePositions(a[index], b[index])) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+
+// Verifies that trees decoded with borrowInputBuffer and/or an arena are equal
+// to a tree decoded without them, and that clones of them do not depend on
+// the input buffer or the arena.
+static void _testBorrowed(std::string name) {
+  std::ifstream infile("assets/" + name + "_test.hjson", std::ifstream::ate |
+    std::ifstream::binary);
+  if (!infile.is_open()) {
+    infile.open("assets/" + name + "_test.json", std::ifstream::ate |
+      std::ifstream::binary);
+  }
+  auto text = _readStream(&infile);
+
+  Hjson::DecoderOptions decOpt;
+  auto copied = Hjson::Unmarshal(text, decOpt);
+  auto copiedText = Hjson::Marshal(copied);
+  auto copiedClone = copied.clone();
+  auto copiedCloneText = Hjson::Marshal(copiedClone);
+
+  for (int mode = 1; mode < 4; ++mode) {
+    auto arena = std::unique_ptr<Hjson::Arena>(new Hjson::Arena(256));
+    auto buffer = text;
+    decOpt.borrowInputBuffer = !!(mode & 1);
+    decOpt.arena = (mode & 2) ? arena.get() : nullptr;
+    auto borrowed = Hjson::Unmarshal(buffer, decOpt);
+    assert(borrowed.deep_equal(copied));
+    assert(Hjson::Marshal(borrowed) == copiedText);
+
+    auto cloned = borrowed.clone();
+    borrowed = Hjson::Value();
+    std::fill(buffer.begin(), buffer.end(), 'x');
+    arena.reset();
+    assert(cloned.deep_equal(copiedClone));
+    assert(Hjson::Marshal(cloned) == copiedCloneText);
+    assert(_samePositions(cloned, copiedClone));
+  }
+}
+
+
+// Builds a Value tree (without comments) from the events of
+// Hjson::Unmarshal(data, handler).
+class TreeBuilder : public Hjson::DecodeHandler {
+public:
+  Hjson::Value root;
+  std::vector<Hjson::Value> stack;
+  std::vector<std::string> keys;
+
+  void add(const Hjson::Value& val) {
+    if (stack.empty()) {
+      root = val;
+    } else if (stack.back().type() == Hjson::Type::Vector) {
+      stack.back().push_back(val);
+    } else {
+      stack.back()[keys.back()] = val;
+      keys.pop_back();
+    }
+  }
+
+  bool on_map_begin() override {
+    stack.push_back(Hjson::Value(Hjson::Type::Map));
+    return true;
+  }
+  bool on_map_end() override {
+    auto val = stack.back();
+    stack.pop_back();
+    add(val);
+    return true;
+  }
+  bool on_vector_begin() override {
+    stack.push_back(Hjson::Value(Hjson::Type::Vector));
+    return true;
+  }
+  bool on_vector_end() override {
+    return on_map_end();
+  }
+  bool on_key(const char *key, size_t size) override {
+    keys.push_back(std::string(key, size));
+    return true;
+  }
+  bool on_string(const char *str, size_t size) override {
+    add(std::string(str, size));
+    return true;
+  }
+  bool on_int64(std::int64_t i) override {
+    add(i);
+    return true;
+  }
+  bool on_double(double d) override {
+    add(d);
+    return true;
+  }
+  bool on_bool(bool b) override {
+    add(b);
+    return true;
+  }
+  bool on_null() override {
+    add(Hjson::Value(Hjson::Type::Null));
+    return true;
+  }
+};
+
+
+// Compares the events from the test file to the tree from Unmarshal().
+static void _testHandler(std::string name) {
+  std::ifstream infile("assets/" + name + "_test.hjson", std::ifstream::ate |
+    std::ifstream::binary);
+  if (!infile.is_open()) {
+    infile.open("assets/" + name + "_test.json", std::ifstream::ate |
+      std::ifstream::binary);
+  }
+  auto text = _readStream(&infile);
+
+  std::string expectedErr, gotErr;
+  Hjson::Value expected;
+  try {
+    expected = Hjson::Unmarshal(text);
+  } catch (const Hjson::syntax_error& e) {
+    expectedErr = e.what();
+  }
+
+  TreeBuilder builder;
+  try {
+    assert(Hjson::Unmarshal(text, builder));
+  } catch (const Hjson::syntax_error& e) {
+    gotErr = e.what();
+  }
+
+  assert(gotErr == expectedErr);
+  if (expectedErr.empty()) {
+    assert(builder.stack.empty() && builder.keys.empty());
+    assert(builder.root.deep_equal(expected));
+  }
+}
+
+
+// Feeds the test file in chunks of different sizes to a PushDecoder and
+// compares the result (or the error message) to that from Unmarshal().
+static void _testPushDecoder(std::string name) {
+  std::ifstream infile("assets/" + name + "_test.hjson", std::ifstream::ate |
+    std::ifstream::binary);
+  if (!infile.is_open()) {
+    infile.open("assets/" + name + "_test.json", std::ifstream::ate |
+      std::ifstream::binary);
+  }
+  auto text = _readStream(&infile);
+
+  Hjson::EncoderOptions encOpt;
+  encOpt.comments = true;
+
+  for (int wsc = 0; wsc < 2; ++wsc) {
+    Hjson::DecoderOptions decOpt;
+    decOpt.whitespaceAsComments = !!wsc;
+
+    Hjson::Value expected;
+    std::string expectedErr;
+    try {
+      expected = Hjson::Unmarshal(text, decOpt);
+    } catch (const Hjson::syntax_error& e) {
+      expectedErr = e.what();
+    }
+
+    Hjson::PushDecoder decoder(decOpt);
+
+    for (size_t chunkSize : {1, 2, 3, 7, 64, 4096}) {
+      Hjson::Value got;
+      std::string gotErr;
+      try {
+        for (size_t pos = 0; pos < text.size(); pos += chunkSize) {
+          decoder.feed(text.data() + pos, std::min(chunkSize,
+            text.size() - pos));
+        }
+        got = decoder.finish();
+      } catch (const Hjson::syntax_error& e) {
+        gotErr = e.what();
+      }
+
+      if (gotErr != expectedErr) {
+        std::cout << "PushDecoder error for " << name << " (chunk size " <<
+          chunkSize << "):\n" << gotErr << "\nExpected:\n" << expectedErr << "\n";
+        assert(false);
+      }
+      assert(got.deep_equal(expected));
+      assert(Hjson::Marshal(got, encOpt) == Hjson::Marshal(expected, encOpt));
+    }
+  }
+}
+
+
 static bool _evaluate(std::string name, std::string expected, Hjson::Value root, std::string got) {
   // Visual studio will have trailing null chars in rhjson if there was any
   // CRLF conversion when reading it from the file. If so, `==` would return
@@ -154,6 +361,9 @@ static void _examine(std::string filename) {
 
   bool shouldFail = !name.compare(0, 4, "fail");
 
+  _testPushDecoder(name);
+  _testHandler(name);
+
   Hjson::Value root;
   try {
     root = _getTestContent(name);
@@ -170,6 +380,8 @@ static void _examine(std::string filename) {
     }
   }
 
+  _testBorrowed(name);
+
   std::string extra = "";
 #if HJSON_USE_CHARCONV
   extra = "charconv/";
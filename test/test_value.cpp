@@ -2,7 +2,10 @@
 #include <cmath>
 #include <cstring>
 #include <sstream>
+#include <fstream>
 #include <cstdio>
+#include <limits>
+#include <thread>
 #include "hjson_test.h"
 
 
@@ -487,25 +490,25 @@ void test_value() {
     assert(it->first == "first");
     assert(it->second == "leaf1");
     ++it;
-    assert(it->first == "fourth");
-    assert(it->second == 4);
-    ++it;
     assert(it->first == "second");
     assert(it->second == "leaf1");
     ++it;
+    assert(it->first == "fourth");
+    assert(it->second == 4);
+    ++it;
     assert(it == val.end());
 
     const Hjson::Value valConst = val;
-    std::map<std::string, Hjson::Value>::const_iterator itConst = valConst.begin();
+    Hjson::Value::ValueMap::const_iterator itConst = valConst.begin();
     assert(itConst->first == "first");
     assert(itConst->second == "leaf1");
     ++itConst;
-    assert(itConst->first == "fourth");
-    assert(itConst->second == 4);
-    ++itConst;
     assert(itConst->first == "second");
     assert(itConst->second == "leaf1");
     ++itConst;
+    assert(itConst->first == "fourth");
+    assert(itConst->second == 4);
+    ++itConst;
     assert(itConst == valConst.end());
   }
 
@@ -1279,6 +1282,524 @@ beta: a// cm 2
     std::remove(szTmp);
   }
 
+  {
+    const char *szTmp = "tmpTestFile.hjson";
+    Hjson::DecoderOptions decOpt;
+    decOpt.borrowInputBuffer = true;
+
+    auto root1 = Hjson::UnmarshalFromFile("assets/strings_test.hjson");
+    auto root2 = Hjson::UnmarshalFromFile("assets/strings_test.hjson", decOpt);
+    assert(root2.deep_equal(root1));
+    Hjson::Value val = root2["text1"];
+    root2 = Hjson::Value();
+    assert(val == root1["text1"]);
+
+    {
+      std::ofstream outfile(szTmp, std::ofstream::binary);
+      outfile << "a: b\r\n";
+      outfile.write("\0\0", 2);
+    }
+    auto root3 = Hjson::UnmarshalFromFile(szTmp, decOpt);
+    assert(root3["a"] == "b");
+
+    {
+      std::ofstream outfile(szTmp, std::ofstream::binary);
+    }
+    auto root4 = Hjson::UnmarshalFromFile(szTmp, decOpt);
+    assert(root4.type() == Hjson::Type::Map && root4.empty());
+    std::remove(szTmp);
+
+    std::stringstream ss("x: quoteless");
+    ss >> Hjson::StreamDecoder(root3, decOpt);
+    ss.str("");
+    assert(root3["x"] == "quoteless");
+  }
+
+  {
+    Hjson::PushDecoder decoder;
+    decoder.feed("{\n  a: [1, 2", 12);
+    decoder.feed("]\n  b: ", 7);
+    decoder.feed("text\n}", 6);
+    auto root = decoder.finish();
+    assert(root["a"][1] == 2);
+    assert(root["b"] == "text");
+
+    // A root without braces can turn out to be a single quoteless string.
+    decoder.feed("a: {", 4);
+    decoder.feed(" b", 2);
+    root = decoder.finish();
+    assert(root == "a: { b");
+
+    // Errors are found before the end of the input if possible.
+    bool thrown = false;
+    try {
+      decoder.feed("{\n  a: 1]\n  b: 2, c: 3\n", 24);
+    } catch (const Hjson::syntax_error&) {
+      thrown = true;
+    }
+    assert(thrown);
+    decoder.feed("[3]", 3);
+    root = decoder.finish();
+    assert(root[0] == 3);
+
+    // The line number must be correct also after discarding parsed input.
+    std::string str = "[\n";
+    for (int i = 0; i < 1000; ++i) {
+      str += "  # comment\n  " + std::to_string(i) + "\n";
+    }
+    str += "  }\n]";
+    std::string expected;
+    try {
+      Hjson::Unmarshal(str);
+    } catch (const Hjson::syntax_error& e) {
+      expected = e.what();
+    }
+    assert(expected.find("line 2002") != std::string::npos);
+    std::string got;
+    try {
+      for (size_t pos = 0; pos < str.size(); pos += 5) {
+        decoder.feed(str.data() + pos, std::min(str.size() - pos, (size_t)5));
+      }
+      decoder.finish();
+    } catch (const Hjson::syntax_error& e) {
+      got = e.what();
+    }
+    assert(got == expected);
+  }
+
+  {
+    Hjson::Arena arena(64);
+    char *p1 = static_cast<char*>(arena.allocate(3, 1));
+    auto p2 = static_cast<std::int64_t*>(arena.allocate(sizeof(std::int64_t),
+      alignof(std::int64_t)));
+    assert(reinterpret_cast<std::uintptr_t>(p2) % alignof(std::int64_t) == 0);
+    assert(reinterpret_cast<char*>(p2) >= p1 + 3);
+    size_t capacity = arena.capacity();
+    assert(capacity >= 64);
+    // Does not fit in the current block.
+    char *p3 = static_cast<char*>(arena.allocate(1000, 1));
+    assert(arena.capacity() >= capacity + 1000);
+    std::memset(p3, 0, 1000);
+    // Still fits in the first block.
+    char *p4 = static_cast<char*>(arena.allocate(1, 1));
+    assert(p4 > p1 && p4 < p1 + 64);
+
+    Hjson::DecoderOptions decOpt;
+    decOpt.arena = &arena;
+    std::string str = R"(
+a: [1, 2.5, true, null, "quoted", "esc\ta\"pe"]
+b: quoteless
+c: {}
+)";
+    auto root = Hjson::Unmarshal(str, decOpt);
+    assert(root.deep_equal(Hjson::Unmarshal(str)));
+    assert(arena.capacity() > capacity + 1000);
+    assert(root["a"][5] == "esc\ta\"pe");
+    auto cloned = root.clone();
+    assert(cloned["a"][1].get_pos_item() == root["a"][1].get_pos_item());
+    assert(cloned["a"][1].get_pos_item() > 0);
+    assert(cloned["b"].get_pos_item() == root["b"].get_pos_item());
+    assert(cloned["b"].get_pos_key() == root["b"].get_pos_key());
+    root["a"][4] += "!";
+    assert(root["a"][4] == "quoted!");
+    root["c"]["d"] = 3;
+    assert(root["c"]["d"] == 3);
+  }
+
+  {
+    class KeyFinder : public Hjson::DecodeHandler {
+    public:
+      std::string comments;
+      std::int64_t found = -1;
+      bool isTarget = false;
+      int events = 0;
+
+      bool on_key(const char *key, size_t size) override {
+        ++events;
+        isTarget = std::string(key, size) == "b";
+        return true;
+      }
+      bool on_int64(std::int64_t value) override {
+        ++events;
+        if (isTarget) {
+          found = value;
+          return false;
+        }
+        return true;
+      }
+      bool on_comment(const char *comment, size_t size) override {
+        comments.append(comment, size);
+        return true;
+      }
+    };
+
+    std::string str = "# start\na: 1\nb: 2\nc: 3\n";
+    KeyFinder finder;
+    assert(!Hjson::Unmarshal(str, finder));
+    assert(finder.found == 2);
+    assert(finder.events == 4);
+    assert(finder.comments == "# start\n");
+
+    KeyFinder noStop;
+    assert(Hjson::Unmarshal("[1, 2]", noStop));
+    assert(noStop.events == 2);
+  }
+
+  {
+    Hjson::DecoderOptions decOpt;
+    decOpt.whitespaceAsComments = true;
+    std::string str = "# head\na: 1 # one\nb: 2\n";
+    auto root = Hjson::Unmarshal(str, decOpt);
+    // The comments must not depend on the input string.
+    str.assign(str.size(), 'x');
+    assert(root["a"].get_comment_before() == "# head\n");
+    assert(root["a"].get_comment_after() == " # one");
+    Hjson::Value a = root["a"];
+    a.set_comment_after(" # changed");
+    assert(a.get_comment_after() == " # changed");
+    assert(root["a"].get_comment_after() == " # one");
+    root["b"].set_comment_before("\n# new\n");
+    assert(root["b"].get_comment_before() == "\n# new\n");
+    assert(root["b"].get_comment_key() == " ");
+
+    decOpt.borrowInputBuffer = true;
+    str = "[\n  # elem\n  1\n]";
+    root = Hjson::Unmarshal(str, decOpt);
+    auto clone = root.clone();
+    str.assign(str.size(), 'x');
+    assert(clone[0].get_comment_before() == "\n  # elem\n  ");
+    assert(clone[0].get_pos_item() == root[0].get_pos_item());
+    assert(clone[0].get_pos_item() > 0);
+  }
+
+  {
+    auto root = Hjson::Unmarshal(R"([
+  0.1
+  -1.25E+10
+  1e23
+  2.2250738585072014e-308
+  4.35e-300
+  1.7976931348623157e308
+  1e400
+  9223372036854775807
+  -9223372036854775808
+  9223372036854775808
+  1.00000000000000011102230246251565404236316680908203125
+  1.00000000000000011102230246251565404236316680908203126
+])");
+    assert(root[0] == 0.1);
+    assert(root[1] == -1.25e10);
+    assert(root[2] == 1e23);
+    assert(root[3] == 2.2250738585072014e-308);
+    assert(root[4] == 4.35e-300);
+    assert(root[5] == 1.7976931348623157e308);
+    assert(root[6] == "1e400");
+    assert(root[7].type() == Hjson::Type::Int64);
+    assert(root[7] == std::numeric_limits<std::int64_t>::max());
+    assert(root[8] == std::numeric_limits<std::int64_t>::min());
+    assert(root[9].type() == Hjson::Type::Double);
+    assert(root[9] == 9223372036854775808.0);
+    // Exactly halfway between 1 and the next double, rounds to even.
+    assert(root[10] == 1.0);
+    assert(root[11] == 1.0000000000000002);
+  }
+
+  {
+    // Big enough to be split into parts for decoding in parallel.
+    std::string str = "# root\n";
+    for (int a = 0; a < 3; ++a) {
+      str += "list" + std::to_string(a) + ": [ // elems\n";
+      for (int b = 0; b < 4000; ++b) {
+        str += "  { id: " + std::to_string(b) + ", tags: [\"a\", 'b'] }, # c\n"
+          "  quoteless, with {braces} and [brackets]\n"
+          "  /* block */ '''\n    multi\n    line\n    '''\n";
+      }
+      str += "]\n";
+    }
+    str += "last: 1 # after\n";
+
+    Hjson::DecoderOptions decOpt;
+    decOpt.whitespaceAsComments = true;
+    auto root1 = Hjson::Unmarshal(str, decOpt);
+    decOpt.threads = 4;
+    auto root2 = Hjson::Unmarshal(str, decOpt);
+    assert(root2.deep_equal(root1));
+    assert(Hjson::Marshal(root2) == Hjson::Marshal(root1));
+    assert(root2["list2"][11999].get_pos_item() == root1["list2"][11999].get_pos_item());
+    assert(root2["list1"][3].get_comment_before() == root1["list1"][3].get_comment_before());
+
+    decOpt.comments = false;
+    decOpt.whitespaceAsComments = false;
+    root2 = Hjson::Unmarshal(str, decOpt);
+    assert(root2.deep_equal(root1));
+
+    // Same error as when decoded by a single thread.
+    str.insert(str.find("  { id: 2000", str.find("list1")), "}\n");
+    std::string err1, err2;
+    try {
+      decOpt.threads = 1;
+      Hjson::Unmarshal(str, decOpt);
+    } catch (const Hjson::syntax_error& e) {
+      err1 = e.what();
+    }
+    try {
+      decOpt.threads = 4;
+      Hjson::Unmarshal(str, decOpt);
+    } catch (const Hjson::syntax_error& e) {
+      err2 = e.what();
+    }
+    assert(!err1.empty() && err2 == err1);
+  }
+
+  {
+    std::vector<std::string> inputs;
+    for (int a = 0; a < 200; ++a) {
+      inputs.push_back("# doc\na: " + std::to_string(a) + " // c\nb: [1, 'x']\n");
+    }
+    inputs[7] = "";
+    inputs[8] = "\"single\"";
+    inputs[50] = "{a: [1, 2";
+    inputs[51] = "a: 1\na: 2";
+
+    Hjson::DecoderOptions decOpt;
+    decOpt.duplicateKeyException = true;
+    decOpt.threads = 3;
+    auto results = Hjson::UnmarshalBatch(inputs, decOpt);
+    assert(results.size() == inputs.size());
+    for (size_t a = 0; a < inputs.size(); ++a) {
+      std::string err;
+      Hjson::Value val;
+      try {
+        val = Hjson::Unmarshal(inputs[a], decOpt);
+      } catch (const Hjson::syntax_error& e) {
+        err = e.what();
+      }
+      assert(results[a].error == err);
+      assert(results[a].value.deep_equal(val));
+      assert(Hjson::Marshal(results[a].value) == Hjson::Marshal(val));
+    }
+    assert(results[199].value["a"] == 199);
+    assert(results[199].value["a"].get_comment_after() == " // c");
+    assert(results[8].value == "single");
+    assert(!results[50].error.empty() && !results[51].error.empty());
+    assert(!results[50].value.defined());
+
+    decOpt.whitespaceAsComments = true;
+    results = Hjson::UnmarshalBatch(inputs.data() + 1, 1, decOpt);
+    assert(results.size() == 1);
+    assert(Hjson::Marshal(results[0].value) ==
+      Hjson::Marshal(Hjson::Unmarshal(inputs[1], decOpt)));
+  }
+
+  {
+    std::string str = "# first\n{a: 1} // one\n{\n  b: [2]\n}{c: 3}\n[4, 5]\n"
+      "{ d: [6 }\n" "junk\n" "{e: 7}\n";
+    std::istringstream iss(str);
+    Hjson::DocumentReader readers[] = {
+      Hjson::DocumentReader(str.data(), str.size()),
+      Hjson::DocumentReader(iss),
+    };
+
+    for (auto& reader : readers) {
+      Hjson::Value doc;
+      assert(reader.next(doc));
+      assert(doc["a"] == 1);
+      assert(doc.get_comment_before() == "# first\n");
+      assert(doc.get_comment_after() == " // one");
+      assert(reader.doc_begin() == 8 && reader.doc_end() == 14);
+      assert(reader.next(doc = Hjson::Value()));
+      assert(doc["b"][0] == 2);
+      assert(doc["b"].get_pos_item() == 29);
+      assert(reader.next(doc = Hjson::Value()));
+      assert(doc["c"] == 3);
+      assert(reader.next(doc = Hjson::Value()));
+      assert(doc[1] == 5);
+      try {
+        reader.next(doc);
+        assert(false);
+      } catch (const Hjson::syntax_error& e) {
+        assert(std::string(e.what()).find("at line 7,9") != std::string::npos);
+      }
+      assert(str.substr(reader.doc_begin(), reader.doc_end() -
+        reader.doc_begin()) == "{ d: [6 }\njunk\n");
+      assert(reader.next(doc = Hjson::Value()));
+      assert(doc["e"] == 7);
+      assert(!reader.next(doc));
+      assert(!reader.next(doc));
+    }
+  }
+
+  {
+    Hjson::DecoderOptions decOpt;
+    decOpt.duplicateKeyException = true;
+    Hjson::Decoder decoder(decOpt);
+    const char *inputs[] = {
+      "{\n  # c\n  a: \"x\\ty\"\n  b: '''\n    ml\n    '''\n}",
+      "[1, \"\\u00e9\", {c: [null]}]",
+      "a: 1\na: 2",
+      "{a: [1, 2}",
+      "\"single\"",
+      "",
+    };
+
+    for (auto input : inputs) {
+      std::string err1, err2;
+      Hjson::Value val1, val2;
+      try {
+        val1 = Hjson::Unmarshal(input, decOpt);
+      } catch (const Hjson::syntax_error& e) {
+        err1 = e.what();
+      }
+      try {
+        val2 = decoder.decode(input);
+      } catch (const Hjson::syntax_error& e) {
+        err2 = e.what();
+      }
+      assert(err2 == err1);
+      assert(val2.deep_equal(val1));
+      assert(Hjson::Marshal(val2) == Hjson::Marshal(val1));
+    }
+
+    auto val = decoder.decode(std::string("{a: 'x\\ny'}"));
+    assert(val["a"] == "x\ny");
+    assert(!decoder.decode(nullptr).defined());
+  }
+
+  {
+    const char *inputs[] = {
+      "// config\n{\n  b: {x: [1, {y: 'z'}], \"q k\": 2}  # after b\n  a: 3\n"
+        "  b: {c: '''\n    ml\n    '''}\n  d: [\n  ]\n  e: x, y\n}",
+      "b: {x: [1, {y: \"z\"}]}\na: 3\nd: []\n",
+      "[{a: 1}, [2, 3], 'x']",
+    };
+
+    for (auto input : inputs) {
+      auto val = Hjson::Unmarshal(input);
+      auto lazy = Hjson::UnmarshalLazy(std::string(input));
+      assert(lazy.type() == val.type());
+      assert(lazy.size() == val.size());
+      assert(lazy.to_value().deep_equal(val));
+      assert(Hjson::Marshal(lazy.to_value()) == Hjson::Marshal(val));
+      for (int i = 0; i < static_cast<int>(val.size()); ++i) {
+        assert(lazy[i].type() == val[i].type());
+        assert(lazy[i].to_value().deep_equal(val[i]));
+        assert(lazy[i].to_value().get_pos_item() == val[i].get_pos_item());
+        if (val.type() == Hjson::Type::Map) {
+          assert(lazy.key(i) == val.key(i));
+        }
+      }
+    }
+
+    auto lazy = Hjson::UnmarshalLazy(inputs[0]);
+    assert(lazy["b"]["c"].to_value() == "ml");
+    assert(!lazy["b"]["x"].defined());
+    assert(lazy["d"].type() == Hjson::Type::Vector && lazy["d"].empty());
+    assert(lazy["e"].to_value() == "x, y");
+    assert(lazy["a"].to_value().get_pos_key() == 59);
+    assert(!lazy["nope"].defined() && !lazy["nope"]["x"].defined());
+    try {
+      lazy["d"]["x"];
+      assert(false);
+    } catch (const Hjson::type_mismatch&) {
+    }
+    try {
+      lazy["d"][0];
+      assert(false);
+    } catch (const Hjson::index_out_of_bounds&) {
+    }
+
+    lazy = Hjson::UnmarshalLazy(std::string("\"single\" # c"));
+    assert(lazy.type() == Hjson::Type::String);
+    assert(lazy.to_value().get_comment_after() == " # c");
+
+    // Errors inside strings are found when the string is decoded.
+    std::string str = "{\n  a: 1\n  b: [\"bad \\q\"]\n}";
+    std::string err;
+    try {
+      Hjson::Unmarshal(str);
+    } catch (const Hjson::syntax_error& e) {
+      err = e.what();
+    }
+    assert(!err.empty());
+    lazy = Hjson::UnmarshalLazy(str);
+    assert(lazy["a"].to_value() == 1);
+    assert(lazy["b"].size() == 1);
+    try {
+      lazy["b"][0].to_value();
+      assert(false);
+    } catch (const Hjson::syntax_error& e) {
+      assert(e.what() == err);
+    }
+    try {
+      Hjson::UnmarshalLazy(std::string("{\n  a: [1, 2}\n}"));
+      assert(false);
+    } catch (const Hjson::syntax_error& e) {
+      assert(std::string(e.what()).find("at line 2,") != std::string::npos);
+    }
+
+    Hjson::DecoderOptions decOpt;
+    decOpt.duplicateKeyException = true;
+    str = "{\n  a: {b: 1, b: 2}\n  c: 3\n}";
+    lazy = Hjson::UnmarshalLazy(str, decOpt);
+    assert(lazy["c"].to_value() == 3);
+    try {
+      lazy["a"]["b"];
+      assert(false);
+    } catch (const Hjson::syntax_error& e) {
+      assert(std::string(e.what()).find("Found duplicate of key 'b' at line 2,") !=
+        std::string::npos);
+    }
+  }
+
+  {
+    std::string str = "{\n  services: {\n    web: {port: 80, hosts: [\"a\", \"b\"]}\n"
+      "    db: {\n      port: 5432  # default\n      user: \"bad \\q\"\n    }\n  }\n"
+      "  limits: {max: 3}\n  list: [10, {a: 11, b: 12}, [13]]\n  other: x\n}";
+    Hjson::DecoderOptions decOpt;
+    decOpt.keyPaths = {"services.*.port", "limits", "list.1.b", "list.*.0"};
+    std::vector<std::string> skipped;
+    decOpt.skippedValueHandler = [&](const std::string& keyPath, size_t begin,
+      size_t end)
+    {
+      skipped.push_back(keyPath + "=" + str.substr(begin, end - begin));
+    };
+
+    auto val = Hjson::Unmarshal(str, decOpt);
+    assert(val["services"]["web"].size() == 1);
+    assert(val["services"]["web"]["port"] == 80);
+    assert(val["services"]["db"].size() == 1);
+    assert(val["services"]["db"]["port"] == 5432);
+    assert(val["services"]["db"]["port"].get_comment_after() == "  # default");
+    assert(val["limits"]["max"] == 3);
+    // A value on the way to a key path is kept even if it is not a map.
+    assert(val["list"].size() == 3 && val["list"][0] == 10);
+    assert(val["list"][1].size() == 1 && val["list"][1]["b"] == 12);
+    assert(val["list"][2].size() == 1 && val["list"][2][0] == 13);
+    assert(!val["other"].defined());
+    std::vector<std::string> expected = {
+      "services.web.hosts=[\"a\", \"b\"]",
+      "services.db.user=\"bad \\q\"",
+      "list.1.a=11",
+      "other=x",
+    };
+    assert(skipped == expected);
+
+    Hjson::PushDecoder decoder(decOpt);
+    for (size_t i = 0; i < str.size(); ++i) {
+      decoder.feed(&str[i], 1);
+    }
+    assert(Hjson::Marshal(decoder.finish()) == Hjson::Marshal(val));
+
+    // The structure of skipped values is still checked.
+    str.insert(str.find("[13]"), "}");
+    try {
+      Hjson::Unmarshal(str, decOpt);
+      assert(false);
+    } catch (const Hjson::syntax_error& e) {
+      assert(std::string(e.what()).find("at line 10,") != std::string::npos);
+    }
+  }
+
   {
     Hjson::Value val1(1), val2(2);
 
@@ -1676,4 +2197,507 @@ key: val2
       assert(!"Did not throw error for duplicate key");
     } catch(const Hjson::syntax_error& e) {}
   }
+
+  {
+    // Whitespace and comment runs longer than the vectorized scan width, with
+    // stop chars on both sides of the 16/32 byte block boundaries.
+    std::string pad(70, ' ');
+    std::string str = "{" + pad + "\n\t# line comment" + pad + "\n" + pad +
+      "a: 1" + pad + "/* block * comment" + pad + "**/" + pad + "\n" + pad +
+      "// another" + pad + "\n" + pad + "b: 2" + pad + "\n}";
+    Hjson::DecoderOptions decOpt;
+    decOpt.whitespaceAsComments = true;
+    auto root = Hjson::Unmarshal(str, decOpt);
+    assert(root["a"] == 1);
+    assert(root["b"] == 2);
+    assert(root["a"].get_comment_before() == pad + "\n\t# line comment" + pad +
+      "\n" + pad);
+    assert(root["a"].get_comment_after() == pad + "/* block * comment" + pad +
+      "**/" + pad);
+    assert(Hjson::Marshal(root) == str);
+
+    for (size_t len = 0; len < 80; ++len) {
+      std::string str2 = "[1" + std::string(len, '\n') + "/*" +
+        std::string(len, '*') + "*/#" + std::string(len, ' ') + "\n2]";
+      auto root2 = Hjson::Unmarshal(str2, decOpt);
+      assert(root2.size() == 2);
+      assert(root2[0].get_comment_after() + root2[1].get_comment_before() ==
+        str2.substr(2, str2.size() - 4));
+      try {
+        Hjson::Unmarshal("[1 /*" + std::string(len, '*'), decOpt);
+        assert(!"Did not throw error for unterminated block comment");
+      } catch(const Hjson::syntax_error& e) {}
+    }
+  }
+
+  {
+    std::string str = R"(
+a: "abc"
+b: quoteless string
+c: "esc\tape"
+d: '''
+  multi
+  line'''
+e: "42"
+)";
+    Hjson::DecoderOptions decOpt;
+    decOpt.borrowInputBuffer = true;
+    auto root = Hjson::Unmarshal(str, decOpt);
+    assert(root.deep_equal(Hjson::Unmarshal(str)));
+    assert(root["a"] == "abc");
+    assert(root["a"] < root["b"]);
+    assert(root["a"] != root["b"]);
+    assert(root["b"].to_string() == "quoteless string");
+    assert(root["c"] == "esc\tape");
+    assert(root["d"] == "multi\nline");
+    assert(root["e"].to_int64() == 42);
+    assert(root["e"].to_double() == 42.0);
+    assert(!std::strcmp(static_cast<const char*>(root["a"]), "abc"));
+    Hjson::Value val = root["b"];
+    val += "!";
+    assert(val == "quoteless string!");
+    assert(root["a"] + root["e"] == "abc42");
+    auto cloned = root.clone();
+    str.assign(str.size(), ' ');
+    assert(cloned["b"] == "quoteless string!");
+  }
+
+  {
+    // Long strings, with escape sequences and line breaks on both sides of
+    // the blocks that are scanned at a time.
+    for (int len = 0; len < 70; ++len) {
+      std::string plain(len, 'x');
+      auto root = Hjson::Unmarshal("{a: \"" + plain + "\", b: '" + plain +
+        "\\n" + plain + "\\\\\"', c: '''\n  " + plain + "\\n\r\n  '" + plain +
+        "'\n  '''}");
+      assert(root["a"] == plain);
+      assert(root["b"] == plain + "\n" + plain + "\\\"");
+      assert(root["c"] == plain + "\\n\n'" + plain + "'");
+      try {
+        Hjson::Unmarshal("{a: \"" + plain + "\n\"}");
+        assert(false);
+      } catch (const Hjson::syntax_error&) {
+      }
+      try {
+        Hjson::Unmarshal("{a: \"" + plain);
+        assert(false);
+      } catch (const Hjson::syntax_error&) {
+      }
+    }
+    std::string withZero("{a: \"x\0y\"}", 11);
+    assert(Hjson::Unmarshal(withZero)["a"] == std::string("x\0y", 3));
+  }
+
+  {
+    // The insertion order stays in sync with the elements when the map is
+    // changed in different ways.
+    Hjson::Value val;
+    val["one"] = 1;
+    val["two"] = 2;
+    val["three"] = 3;
+    val["four"] = 4;
+    assert(val.erase("two") == 1);
+    assert(val.erase("two") == 0);
+    val.erase(0);
+    val.move(1, 0);
+    val["five"] = 5;
+    val["three"] = 33;
+    assert(val.size() == 3);
+    assert(val.key(0) == "four" && val[0] == 4);
+    assert(val.key(1) == "three" && val[1] == 33);
+    assert(val.key(2) == "five" && val[2] == 5);
+    Hjson::Value merged = Hjson::Merge(val, Hjson::Unmarshal("{six: 6, four: 44}"));
+    assert(merged.size() == 4);
+    assert(merged.key(0) == "six" && merged[0] == 6);
+    assert(merged.key(1) == "four" && merged[1] == 44);
+    assert(merged.key(3) == "five" && merged[3] == 5);
+  }
+
+  {
+    // Maps big enough to be indexed by hash, iterated in insertion order.
+    Hjson::Value val;
+    for (int i = 0; i < 100; ++i) {
+      val["k" + std::to_string(99 - i)] = i;
+    }
+    assert(val.size() == 100);
+    assert(val["k0"] == 99 && val.at("k99") == 0);
+    assert(!val["k100"].defined());
+    assert(val.erase("k50") == 1);
+    val.erase(0);
+    val.move(97, 0);
+    assert(val.size() == 98);
+    assert(val.key(0) == "k0" && val[0] == 99);
+    assert(val.key(1) == "k98" && val[1] == 1);
+    assert(!val["k50"].defined() && !val["k99"].defined());
+    int count = 0;
+    for (auto it = val.begin(); it != val.end(); ++it, ++count) {
+      assert(it->first == val.key(count));
+      assert(val[it->first] == it->second);
+    }
+    assert(count == 98);
+    Hjson::EncoderOptions encOpt;
+    encOpt.preserveInsertionOrder = false;
+    auto sorted = Hjson::Marshal(val, encOpt);
+    assert(sorted.find("k0:") < sorted.find("k1:"));
+    assert(sorted.find("k1:") < sorted.find("k10:"));
+    assert(Hjson::Unmarshal(sorted).deep_equal(val));
+    assert(Hjson::Unmarshal(Hjson::Marshal(val)).key(0) == "k0");
+    Hjson::Value other = val.clone();
+    other["k0"] = 1;
+    assert(!other.deep_equal(val));
+    other.erase("k0");
+    other["kx"] = 99;
+    assert(!other.deep_equal(val));
+  }
+
+  {
+    // Bool and Null are stored inside the Value. Changes through a copy of a
+    // number or string are seen by the original.
+    assert(sizeof(Hjson::Value) <= 40);
+    std::string str13(13, 'a'), str14(14, 'b');
+    Hjson::Value val;
+    val["s13"] = str13;
+    val["s14"] = str14;
+    val["i"] = 3;
+    val["s13"] += "";
+    assert(val["s13"] == str13 && val["s14"] == str14);
+    val["s13"] += "c";
+    val["s14"] += "c";
+    assert(val["s13"] == str13 + "c" && val["s14"] == str14 + "c");
+    val["i"]++;
+    val["i"] += 2;
+    assert(val["i"] == 6);
+    const char *pch = val["s13"];
+    val["x"] = 1;
+    assert(!std::strcmp(pch, (str13 + "c").c_str()));
+    Hjson::Value copy = val["s14"];
+    copy += "d";
+    assert(val["s14"] == str14 + "cd" && copy == str14 + "cd");
+    Hjson::Value a(5), b = a;
+    b += 1;
+    assert(a == 6);
+    b++;
+    b *= 2;
+    assert(a == 14);
+    Hjson::Value d(1.5), d2 = d;
+    d2 -= 1.0;
+    assert(d == 0.5);
+    Hjson::Value e = val["i"];
+    e += 3;
+    assert(val["i"] == 9);
+    Hjson::Value t("x"), t2 = t;
+    t2 += "y";
+    assert(t == "xy");
+    Hjson::Value flag(true), flag2 = flag;
+    flag2 = false;
+    assert(flag == true);
+    Hjson::Value vec = Hjson::Value(Hjson::Type::Vector);
+    vec.push_back("short");
+    vec.push_back(str14);
+    vec[0] += "er";
+    vec[1] += "er";
+    assert(vec[0] == "shorter" && vec[1] == str14 + "er");
+    Hjson::Value undef, shared = undef;
+    shared["k"] = "v";
+    assert(undef.type() == Hjson::Type::Map && undef["k"] == "v");
+    assert(Hjson::Value(Hjson::Type::String) == "");
+    assert(Hjson::Value(Hjson::Type::Bool) == false);
+    assert(Hjson::Value(Hjson::Type::Int64) == 0);
+    const Hjson::Value cv = Hjson::Unmarshal("{\na: hi\n}");
+    const char *pcv = cv["a"];
+    assert(!std::strcmp(pcv, "hi"));
+  }
+
+  {
+    // Copies share their comments until one of them is changed.
+    auto root = Hjson::Unmarshal("{\n  # before a\n  a: 1 # after a\n  b: null\n}");
+    Hjson::Value copy = root["a"];
+    assert(copy.get_comment_before() == root["a"].get_comment_before());
+    copy.set_comment_after(" # changed");
+    assert(copy.get_comment_after() == " # changed");
+    assert(root["a"].get_comment_after() == " # after a");
+    assert(copy.get_comment_before() == root["a"].get_comment_before());
+    root["a"].set_comment_key("# key");
+    assert(root["a"].get_comment_key() == "# key");
+    assert(copy.get_comment_key() == "");
+    root["b"].set_comment_before("\n  # before b\n  ");
+    assert(root["b"].get_comment_before() == "\n  # before b\n  ");
+    root["c"].set_comment_before("# not inserted");
+    assert(root.size() == 2);
+    Hjson::Value vec(Hjson::Type::Vector);
+    vec.push_back(copy);
+    vec[0].set_comment_inside("x");
+    assert(vec[0].get_comment_inside() == "x" && copy.get_comment_inside() == "");
+  }
+
+  {
+    // Lookups that return a pointer instead of a temporary Value.
+    auto root = Hjson::Unmarshal("{a: 1, b: {c: \"text\"}}");
+    const Hjson::Value& croot = root;
+    assert(croot.find("a") && *croot.find("a") == 1);
+    assert(croot.find(std::string("b"))->find("c", 1)->to_string() == "text");
+    assert(!croot.find("c") && !croot.find("ab", 2) && croot.find("ab", 1));
+    root.find("a")->set_comment_after(" # one");
+    *root.find("a") = 2;
+    assert(root["a"] == 2 && root["a"].get_comment_after() == " # one");
+    assert(!Hjson::Value().find("a"));
+    assert(root.size() == 2);
+    bool threw = false;
+    try {
+      croot["a"].find("a");
+    } catch (const Hjson::type_mismatch&) {
+      threw = true;
+    }
+    assert(threw);
+  }
+
+  {
+    // Clone and Merge keep the insertion order and the comments.
+    auto base = Hjson::Unmarshal("{\n  # c\n  c: 3\n  a: {x: 1, y: 2}\n  b: 2\n}");
+    auto ext = Hjson::Unmarshal("{\n  b: 22\n  a: {y: 20, z: 30}\n  d: 4\n}");
+    auto cloned = base.clone();
+    assert(cloned.deep_equal(base) && cloned.key(0) == "c");
+    assert(cloned[0].get_comment_before() == base[0].get_comment_before());
+    assert(cloned["a"] != base["a"]);
+    auto merged = Hjson::Merge(base, ext);
+    assert(merged.size() == 4);
+    assert(merged.key(0) == "b" && merged[0] == 22);
+    assert(merged.key(1) == "a" && merged.key(3) == "c");
+    assert(merged.at("a").key(0) == "y" && merged.at("a").key(2) == "x");
+    assert(merged["a"]["y"] == 20 && merged["a"]["x"] == 1);
+    assert(merged["c"].get_comment_before() == base["c"].get_comment_before());
+    assert(!Hjson::Merge(Hjson::Value(Hjson::Type::Map),
+      Hjson::Value(Hjson::Type::Map)).defined());
+  }
+
+  {
+    // Comments decoded from a memory-mapped file must not refer to the file
+    // after the LazyValue is gone, unless borrowInputBuffer is set.
+    const char *szTmp = "tmpTestFile.hjson";
+    {
+      std::ofstream outfile(szTmp, std::ofstream::binary);
+      outfile << "sub: {\n";
+      for (int i = 0; i < 3000; ++i) {
+        outfile << "  # comment " << i << "\n  k" << i << ": " << i << "\n";
+      }
+      outfile << "}\n";
+    }
+    Hjson::DecoderOptions decOpt;
+    decOpt.whitespaceAsComments = true;
+    auto val = Hjson::UnmarshalLazyFromFile(szTmp, decOpt)["sub"].to_value();
+    {
+      std::ofstream outfile(szTmp, std::ofstream::binary);
+      outfile << "a: 1\n";
+    }
+    assert(val["k2999"] == 2999);
+    assert(val["k2999"].get_comment_before() == "\n  # comment 2999\n  ");
+    std::remove(szTmp);
+  }
+
+  {
+    // References to map elements survive insertions and the erasure of other
+    // elements.
+    Hjson::Value val;
+    val["a"] = 1;
+    val["b"] = 2;
+    Hjson::Value& ra = val.at("a");
+    const std::string *pKey = &val.begin()->first;
+    for (int i = 0; i < 100; ++i) {
+      val["k" + std::to_string(i)] = i;
+    }
+    val.erase("b");
+    assert(&val.at("a") == &ra && ra == 1);
+    assert(pKey == &val.begin()->first);
+    ra = 10;
+    assert(val["a"] == 10);
+
+    Hjson::Value::ValueMap::iterator it = val.begin();
+    Hjson::Value::ValueMap::const_iterator cit = it;
+    assert(cit == val.begin() && it != val.end());
+    assert(val.end() - val.begin() == 101);
+    assert((it + 1)->first == "k0" && it[2].second == 1);
+    assert(++it == cit + 1 && it-- > cit && it == cit);
+    assert(std::distance(val.begin(), val.end()) == 101);
+    it->second = 11;
+    assert(val["a"] == 11);
+    const Hjson::Value& cval = val;
+    int count = 0;
+    for (const auto& elem : cval) {
+      count += elem.second.to_int64() >= 0;
+    }
+    assert(count == 101);
+    assert(Hjson::Value().begin() == Hjson::Value().end());
+  }
+
+  {
+    // With duplicateKeyException the decoder adds each element before its
+    // value is decoded. Elements that are left out because of keyPaths must
+    // be removed again, also from the hash table of a larger map.
+    std::string str = "{\n  # first\n  a: {x: 1, y: 2}\n";
+    for (int i = 0; i < 40; ++i) {
+      str += "  k" + std::to_string(i) + ": {x: " + std::to_string(i) +
+        ", y: 0}  # k" + std::to_string(i) + "\n";
+    }
+    str += "  z: [1, 2]\n}";
+    Hjson::DecoderOptions decOpt;
+    decOpt.comments = true;
+    auto lenient = Hjson::Unmarshal(str, decOpt);
+    decOpt.duplicateKeyException = true;
+    auto strict = Hjson::Unmarshal(str, decOpt);
+    Hjson::EncoderOptions encOpt;
+    assert(Hjson::Marshal(strict, encOpt) == Hjson::Marshal(lenient, encOpt));
+    assert(strict["k39"].get_pos_key() == lenient["k39"].get_pos_key());
+
+    decOpt.keyPaths = {"a.x"};
+    for (int i = 0; i < 40; i += 2) {
+      decOpt.keyPaths.push_back("k" + std::to_string(i) + ".x");
+    }
+    std::vector<std::string> skipped;
+    decOpt.skippedValueHandler = [&](const std::string& keyPath, size_t,
+      size_t)
+    {
+      skipped.push_back(keyPath);
+    };
+    auto filtered = Hjson::Unmarshal(str, decOpt);
+    assert(filtered.size() == 21 && !filtered["k39"].defined());
+    assert(filtered["k20"].size() == 1 && filtered["k20"]["x"] == 20);
+    assert(filtered.key(20) == "k38" && filtered.find("k38") != nullptr);
+    assert(skipped.size() == 42 && skipped[0] == "a.y" &&
+      skipped[2] == "k1" && skipped[41] == "z");
+
+    Hjson::PushDecoder decoder(decOpt);
+    for (size_t i = 0; i < str.size(); ++i) {
+      decoder.feed(&str[i], 1);
+    }
+    assert(Hjson::Marshal(decoder.finish()) == Hjson::Marshal(filtered));
+
+    str.insert(str.find("  z:"), "  k8: 1\n");
+    try {
+      Hjson::Unmarshal(str, decOpt);
+      assert(false);
+    } catch (const Hjson::syntax_error& e) {
+      assert(std::string(e.what()).find("Found duplicate of key 'k8'") !=
+        std::string::npos);
+    }
+
+    Hjson::Value map;
+    for (int i = 0; i < 40; ++i) {
+      map["k" + std::to_string(i)] = i;
+    }
+    for (int i = 39; i >= 20; --i) {
+      map.erase("k" + std::to_string(i));
+      assert(map.size() == size_t(i) && map.find("k" + std::to_string(i - 1)));
+    }
+  }
+
+#if !HJSON_NONATOMIC_REFCOUNT
+  // The threads copy Values from the same tree, which needs the atomic
+  // reference counters.
+  {
+    // Threads sharing a decoded tree can get zero-terminated strings from
+    // borrowed values at the same time, and all get the same copy.
+    std::string str = "{\na: text\nb: \"more text\"\nc: [\nx\ny\n]\n}";
+    Hjson::DecoderOptions decOpt;
+    decOpt.borrowInputBuffer = true;
+    const Hjson::Value root = Hjson::Unmarshal(str, decOpt);
+    const char *results[4][4];
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+      threads.emplace_back([&root, &results, t]() {
+        results[t][0] = root["a"];
+        results[t][1] = root["b"];
+        results[t][2] = root["c"][0];
+        results[t][3] = root["c"][1];
+      });
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+    for (int t = 0; t < 4; ++t) {
+      for (int i = 0; i < 4; ++i) {
+        assert(results[t][i] == results[0][i]);
+      }
+    }
+    assert(!std::strcmp(results[0][0], "text"));
+    assert(!std::strcmp(results[0][1], "more text"));
+    assert(!std::strcmp(results[0][3], "y"));
+    // The value still refers to the input buffer.
+    str[5] = 'n';
+    assert(root["a"] == "next");
+    assert(!std::strcmp(root["a"], "text"));
+  }
+#endif
+
+  {
+    std::unique_ptr<Hjson::InternTable> table(new Hjson::InternTable());
+    Hjson::DecoderOptions decOpt;
+    decOpt.internTable = table.get();
+    std::string str = R"([
+  {
+    host: alpha
+    name: "quoted"
+  }
+  {
+    host: "alpha"
+    name: "quoted"
+  }
+  {
+    host: '''alpha'''
+    name: beta
+  }
+])";
+    auto root = Hjson::Unmarshal(str, decOpt);
+    assert(root.deep_equal(Hjson::Unmarshal(str)));
+    assert(table->size() == 3);
+    assert(table->intern("alpha", 5) == table->intern("alpha", 5));
+    assert(table->size() == 3);
+    assert(root[0]["host"] == root[2]["host"]);
+    str.assign(str.size(), 'x');
+    assert(root[1]["name"] == "quoted");
+    // Copies still share the value, but not with other equal values.
+    Hjson::Value host = root[0]["host"];
+    host += "!";
+    assert(root[0]["host"] == "alpha!");
+    assert(root[1]["host"] == "alpha");
+
+    Hjson::Arena arena;
+    decOpt.arena = &arena;
+    auto root2 = Hjson::Unmarshal("[\n  beta\n  gamma\n]", decOpt);
+    assert(table->size() == 4);
+    auto cloned = root2.clone();
+    root = root2 = Hjson::Value();
+    table.reset();
+    assert(cloned[0] == "beta");
+    assert(cloned[1] == "gamma");
+  }
+
+  {
+    // Erasing and moving elements in the middle of a hashed map keeps the
+    // lookups in step with the positions.
+    Hjson::Value map;
+    for (int i = 0; i < 200; ++i) {
+      map["k" + std::to_string(i)] = i;
+    }
+    for (int i = 0; i < 100; ++i) {
+      assert(map.erase("k" + std::to_string(2 * i)) == 1);
+    }
+    assert(map.erase("k0") == 0);
+    map.move(10, 60);
+    map.move(80, 3);
+    map.erase(50);
+    assert(map.size() == 99);
+    for (int i = 0; i < 99; ++i) {
+      auto key = map.key(i);
+      assert(map.at(key) == std::stoi(key.substr(1)));
+      assert(map[i] == map.at(key));
+    }
+    assert(map.key(3) == "k" + std::to_string(2 * 80 + 1));
+    assert(map.key(59) == "k" + std::to_string(2 * 10 + 1));
+    for (int i = 0; i < 200; ++i) {
+      map.erase("k" + std::to_string(i));
+    }
+    assert(map.empty());
+    map["a"] = 1;
+    assert(map.at("a") == 1);
+  }
 }